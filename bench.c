@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "ltable.h"
+
+/*
+** usage: bench [case] [n]
+** runs every case when none given.
+*/
+
+static double
+_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static char**
+_genkeys(int n, const char *prefix) {
+    char **keys = malloc(sizeof(char*) * n);
+    char buf[64];
+    int i;
+    for (i=0; i<n; i++) {
+        int l = snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+        keys[i] = malloc(l+1);
+        memcpy(keys[i], buf, l+1);
+    }
+    return keys;
+}
+
+static void
+_freekeys(char **keys, int n) {
+    int i;
+    for (i=0; i<n; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+/*
+** {=============================================================
+** random lookups with and without huge pages
+** ==============================================================
+*/
+
+static void
+bench_hugepage(int n) {
+    static const struct {
+        const char *name;
+        int flags;
+    } modes[] = {
+        {"malloc", 0},
+        {"align", LTABLE_MEMALIGN},
+        {"thp", LTABLE_MEMHUGE},
+        {"thp+align", LTABLE_MEMHUGE|LTABLE_MEMALIGN},
+        {"hugetlb", LTABLE_MEMHUGETLB},
+    };
+    char **keys = _genkeys(n, "key:");
+    struct ltable_key k;
+    size_t m;
+    int i;
+
+    printf("hugepage: %d string keys, %d random lookups\n", n, n);
+    for (m=0; m<sizeof(modes)/sizeof(modes[0]); m++) {
+        struct ltable *t = ltable_create(sizeof(long), 0);
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        long sum = 0;
+        double t0;
+
+        ltable_setmem(t, modes[m].flags, -1);
+        for (i=0; i<n; i++)
+            *(long*)ltable_set(t, ltable_strkey(&k, keys[i])) = i;
+
+        t0 = _now();
+        for (i=0; i<n; i++) {
+            long *p = ltable_get(t, ltable_strkey(&k, keys[_rand(&seed) % n]));
+            sum += *p;
+        }
+        t0 = _now() - t0;
+        printf("\t%-10s %8.2f Mlookups/s (sum %ld)\n", modes[m].name, n / t0 / 1e6, sum);
+        ltable_release(t);
+    }
+    _freekeys(keys, n);
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** array part growth: realloc, mremap and segments
+** ==============================================================
+*/
+
+static void
+_grow(int n, int flags) {
+    struct ltable *t = ltable_create(sizeof(long), 0);
+    struct ltable_key k;
+    double pause = 0, t0 = _now();
+    int i;
+
+    ltable_setmem(t, flags, -1);
+    for (i=0; i<n; i++) {
+        double t1 = _now();
+        *(long*)ltable_set(t, ltable_intkey(&k, i)) = i;
+        t1 = _now() - t1;
+        if (t1 > pause) pause = t1;
+    }
+    printf("%8.3f s total, %8.2f ms max pause", _now() - t0, pause * 1e3);
+    ltable_release(t);
+}
+
+static void
+bench_growth(int n) {
+    static const struct {
+        const char *name;
+        int flags;
+    } modes[] = {
+        {"realloc", 0},
+        {"mremap", LTABLE_MEMHUGE},
+        {"segment", LTABLE_MEMSEGMENT},
+    };
+    size_t m;
+
+    printf("growth: %d dense int keys\n", n);
+    for (m=0; m<sizeof(modes)/sizeof(modes[0]); m++) {
+        struct rusage ru;
+        int status;
+        pid_t pid;
+
+        printf("\t%-10s ", modes[m].name);
+        fflush(stdout);
+        pid = fork();           /* fresh process, so maxrss is the peak of this mode */
+        if (pid == 0) {
+            _grow(n, modes[m].flags);
+            fflush(stdout);
+            _exit(0);
+        }
+        wait4(pid, &status, 0, &ru);
+        printf(", %8.1f MB peak rss\n", ru.ru_maxrss / 1024.0);
+    }
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** lookups before and after ltable_freeze
+** ==============================================================
+*/
+
+static double
+_lookups(struct ltable *t, char **keys, int n) {
+    struct ltable_key k;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    long sum = 0;
+    double t0 = _now();
+    int i;
+    for (i=0; i<n; i++)
+        sum += *(long*)ltable_get(t, ltable_strkey(&k, keys[_rand(&seed) % n]));
+    t0 = _now() - t0;
+    if (sum == 42) printf("\n");
+    return n / t0 / 1e6;
+}
+
+static void
+bench_freeze(int n) {
+    char **keys = _genkeys(n, "symbol:");
+    struct ltable *t = ltable_create(sizeof(long), 0);
+    struct ltable_key k;
+    size_t sz;
+    double t0;
+    int i;
+
+    for (i=0; i<n; i++)
+        *(long*)ltable_set(t, ltable_strkey(&k, keys[i])) = i;
+    printf("freeze: %d string keys\n", n);
+    printf("\t%-10s %8.2f Mlookups/s, %8.1f MB\n", "mutable",
+           _lookups(t, keys, n), ltable_bytes(t) / 1048576.0);
+
+    t0 = _now();
+    ltable_freeze(t);
+    t0 = _now() - t0;
+    ltable_image(t, &sz);
+    printf("\t%-10s %8.2f Mlookups/s, %8.1f MB, built in %.2f s\n", "frozen",
+           _lookups(t, keys, n), sz / 1048576.0, t0);
+
+    ltable_release(t);
+    _freekeys(keys, n);
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** string lookups with a share of misses, with and without filter
+** ==============================================================
+*/
+
+static void
+bench_filter(int n) {
+    static const int hits[] = {0, 50, 90, 100};
+    char **keys = _genkeys(n, "present:");
+    char **miss = _genkeys(n, "absent:");
+    struct ltable_filterstat st;
+    struct ltable_key k;
+    size_t h;
+    int i, f;
+
+    printf("filter: %d string keys, 10 bits per key\n", n);
+    for (h=0; h<sizeof(hits)/sizeof(hits[0]); h++) {
+        for (f=0; f<2; f++) {
+            struct ltable *t = ltable_create(sizeof(long), 0);
+            uint64_t seed = 0x9e3779b97f4a7c15ULL;
+            long sum = 0;
+            double t0;
+            if (f)
+                ltable_setfilter(t, 10, true);
+            for (i=0; i<n; i++)
+                *(long*)ltable_set(t, ltable_strkey(&k, keys[i])) = i;
+            ltable_filterstat(t, &st);
+            t0 = _now();
+            for (i=0; i<n; i++) {
+                uint64_t r = _rand(&seed);
+                long *v;
+                if ((int)(r % 100) < hits[h])
+                    v = ltable_get(t, ltable_strkey(&k, keys[(r >> 8) % n]));
+                else
+                    v = ltable_get(t, ltable_strkey(&k, miss[(r >> 8) % n]));
+                if (v) sum += *v;
+            }
+            t0 = _now() - t0;
+            if (sum == 42) printf("\n");
+            if (f) {
+                /* count only the lookups above, not the ones done by set */
+                size_t fp = st.falsepos, neg = st.rejects + st.falsepos;
+                ltable_filterstat(t, &st);
+                fp = st.falsepos - fp;
+                neg = st.rejects + st.falsepos - neg;
+                printf("\t%3d%% hits %-8s %8.2f Mlookups/s, fpr %.4f, %.1f MB\n",
+                       hits[h], "filter", n / t0 / 1e6,
+                       neg ? (double)fp / neg : 0, st.bytes / 1048576.0);
+            } else {
+                printf("\t%3d%% hits %-8s %8.2f Mlookups/s\n", hits[h], "plain", n / t0 / 1e6);
+            }
+            ltable_release(t);
+        }
+    }
+    _freekeys(keys, n);
+    _freekeys(miss, n);
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** change journal: hook overhead, flush, replay, delta vs full copy
+** ==============================================================
+*/
+
+struct buffer {
+    char *p;
+    size_t n, cap;
+};
+
+static void
+_append(void *ud, const void *buf, size_t sz) {
+    struct buffer *b = ud;
+    if (b->n + sz > b->cap) {
+        b->cap = (b->n + sz) * 2;
+        b->p = realloc(b->p, b->cap);
+    }
+    memcpy(b->p + b->n, buf, sz);
+    b->n += sz;
+}
+
+static double
+_updates(struct ltable *t, char **keys, int n, int m) {
+    struct ltable_key k;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    double t0 = _now();
+    int i;
+    for (i=0; i<m; i++)
+        *(long*)ltable_set(t, ltable_strkey(&k, keys[_rand(&seed) % n])) = i;
+    return _now() - t0;
+}
+
+static void
+bench_journal(int n) {
+    char **keys = _genkeys(n, "session:");
+    struct ltable *t = ltable_create(sizeof(long), 0);
+    struct ltable *replica = ltable_create(sizeof(long), 0);
+    struct buffer log = {NULL, 0, 0};
+    struct ltable_key k;
+    unsigned int it;
+    long *v;
+    double t0, t1;
+    int i, records;
+
+    printf("journal: %d string keys\n", n);
+    for (i=0; i<n; i++)
+        *(long*)ltable_set(t, ltable_strkey(&k, keys[i])) = i;
+    t0 = _updates(t, keys, n, n);
+    ltable_journal(t, _append, &log);
+    t1 = _updates(t, keys, n, n);
+    printf("\t%-10s %8.2f Mupdates/s, %8.2f with journal\n", "set",
+           n / t0 / 1e6, n / t1 / 1e6);
+
+    /* initial sync */
+    log.n = 0;
+    ltable_journal_snapshot(t);
+    t0 = _now();
+    ltable_journal_flush(t);
+    t0 = _now() - t0;
+    t1 = _now();
+    records = ltable_apply(replica, log.p, log.n);
+    t1 = _now() - t1;
+    printf("\t%-10s %8.2f MB flushed in %.3f s, %8.2f Mrecords/s applied\n", "snapshot",
+           log.n / 1048576.0, t0, records / t1 / 1e6);
+
+    /* 1% of the keys change, then sync again */
+    log.n = 0;
+    _updates(t, keys, n, n / 100);
+    t0 = _now();
+    ltable_journal_flush(t);
+    records = ltable_apply(replica, log.p, log.n);
+    t0 = _now() - t0;
+    printf("\t%-10s %8d records, %8.2f KB, synced in %.4f s\n", "delta",
+           records, log.n / 1024.0, t0);
+
+    /* what a full copy of the table costs instead */
+    ltable_journal(t, NULL, NULL);
+    ltable_release(replica);
+    replica = ltable_create(sizeof(long), 0);
+    t0 = _now();
+    it = 0;
+    while ((v = ltable_next(t, &it, &k)))
+        *(long*)ltable_set(replica, &k) = *v;
+    t0 = _now() - t0;
+    printf("\t%-10s %8zu entries copied in %.4f s\n", "full", ltable_count(replica), t0);
+
+    free(log.p);
+    ltable_release(replica);
+    ltable_release(t);
+    _freekeys(keys, n);
+}
+
+/*
+** }=============================================================
+*/
+
+static const struct {
+    const char *name;
+    void (*fn)(int n);
+    int n;
+} cases[] = {
+    {"hugepage", bench_hugepage, 1<<21},
+    {"growth", bench_growth, 1<<25},
+    {"freeze", bench_freeze, 1<<20},
+    {"filter", bench_filter, 1<<20},
+    {"journal", bench_journal, 1<<20},
+};
+
+int
+main(int argc, char *argv[]) {
+    size_t i;
+    for (i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], cases[i].name))
+            continue;
+        cases[i].fn(argc > 2 ? atoi(argv[2]) : cases[i].n);
+    }
+    return 0;
+}
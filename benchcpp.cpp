@@ -0,0 +1,147 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "ltable.hpp"
+
+/*
+** lt::ltable against std::unordered_map, on the workloads hash map
+** benchmarks usually run (as in abseil's flat_hash_map ones): random
+** 64-bit int keys, and string keys looked up through string_view.
+** usage: benchcpp [n]
+*/
+
+static double
+_now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t
+_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static void
+_report(const char *map, const char *op, int n, double t) {
+    printf("\t%-14s %-12s %8.2f Mops/s\n", map, op, n / t / 1e6);
+}
+
+/* lookups are done through string_view into one buffer, as parsers do */
+struct strkeys {
+    std::string buf;
+    std::vector<std::string_view> hit, miss;
+
+    explicit strkeys(int n) {
+        char tmp[64];
+        std::vector<std::pair<size_t, size_t>> off;
+        for (int i=0; i<2*n; i++) {
+            int l = snprintf(tmp, sizeof(tmp), "user:%08x:session", (unsigned)(i * 2654435761u));
+            off.emplace_back(buf.size(), l);
+            buf.append(tmp, l);
+        }
+        for (int i=0; i<2*n; i++)
+            (i < n ? hit : miss).emplace_back(buf.data() + off[i].first, off[i].second);
+    }
+};
+
+template <class Insert, class Find>
+static void
+_run(const char *map, int n, const std::vector<std::string_view> &hit,
+     const std::vector<std::string_view> &miss, Insert insert, Find find) {
+    uint64_t seed = 88172645463325252ULL;
+    long sum = 0;
+    double t0 = _now();
+    for (int i=0; i<n; i++)
+        insert(hit[i], i);
+    _report(map, "insert", n, _now() - t0);
+
+    t0 = _now();
+    for (int i=0; i<n; i++)
+        sum += find(hit[_rand(&seed) % n]);
+    _report(map, "find hit", n, _now() - t0);
+
+    t0 = _now();
+    for (int i=0; i<n; i++)
+        sum += find(miss[_rand(&seed) % n]);
+    _report(map, "find miss", n, _now() - t0);
+    if (sum == 42) printf("\n");
+}
+
+static void
+bench_string(int n) {
+    strkeys keys(n);
+    printf("string_view keys: %d\n", n);
+    {
+        lt::ltable<long> t;
+        _run("lt::ltable", n, keys.hit, keys.miss,
+             [&](std::string_view k, long v) { t[k] = v; },
+             [&](std::string_view k) { long *p = t.find(k); return p ? *p : 0; });
+    }
+    {
+        std::unordered_map<std::string, long> m;
+        _run("unordered_map", n, keys.hit, keys.miss,
+             [&](std::string_view k, long v) { m[std::string(k)] = v; },
+             [&](std::string_view k) {  /* no heterogeneous lookup before C++20 */
+                 auto it = m.find(std::string(k));
+                 return it == m.end() ? 0 : it->second;
+             });
+    }
+}
+
+static void
+bench_int(int n) {
+    std::vector<long> keys(2*n);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (auto &k : keys)
+        k = (long)(_rand(&seed) >> 1);
+    printf("random int keys: %d\n", n);
+
+    auto run = [&](const char *map, auto &m) {
+        long sum = 0;
+        double t0 = _now();
+        for (int i=0; i<n; i++)
+            m[keys[i]] = i;
+        _report(map, "insert", n, _now() - t0);
+
+        t0 = _now();
+        for (int i=0; i<n; i++)
+            sum += *m.find(keys[_rand(&seed) % n]) != 0;
+        _report(map, "find hit", n, _now() - t0);
+
+        t0 = _now();
+        for (int i=0; i<n; i++)
+            m.erase(keys[i]);
+        _report(map, "erase", n, _now() - t0);
+        if (sum == 42) printf("\n");
+    };
+
+    {
+        lt::ltable<long> t;
+        run("lt::ltable", t);
+    }
+    {
+        /* adapt find to return a pointer like lt::ltable */
+        struct umap : std::unordered_map<long, long> {
+            long* find(long k) { auto it = unordered_map::find(k); return &it->second; }
+        } m;
+        run("unordered_map", m);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1<<20;
+    bench_string(n);
+    bench_int(n);
+    return 0;
+}
@@ -1,10 +1,22 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE             /* mremap */
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define LTABLE_USE_MMAP
+#endif
+
 #include "ltable.h"
 
 #define SHORTSTR_LEN 128
@@ -14,9 +26,26 @@ struct pool_node {
     struct pool_node *next;
 };
 
+/* live strings are only reachable from the nodes, see _freekeys */
 struct pool {
-    struct pool_node *node;
     struct pool_node *freenode;
+    size_t used;                /* bytes held by live strings */
+};
+
+/* smallest out-of-line value block is 2^VBLOCK_MINBITS bytes */
+#define VBLOCK_MINBITS  4
+#define VBLOCK_NCLASS   (sizeof(size_t)*8)
+
+struct vblock {
+    struct vblock *next;        /* valid only while in free list */
+    size_t lsize;               /* log2 of block capacity */
+    size_t size;                /* bytes asked for, see _sizeval */
+    /* follow 2^lsize bytes */
+};
+
+struct vpool {
+    struct vblock *freelist[VBLOCK_NCLASS];
+    size_t used;                /* bytes held by live blocks */
 };
 
 #define MAXBITS      30
@@ -29,11 +58,14 @@ union ltable_Hash {
     double f;
     const void *p;
     long int i;
-    uint8_t l_p[4];
+    uint64_t l;
 };
 
 struct ltable_value {
-    bool setted;
+    bool setted:1;
+    bool outline:1;             /* value lives in a vblock, slot holds its addr */
+    bool ref:1;                 /* read since the clock hand passed, bounded table only */
+    bool dirty:1;               /* set record queued in the journal */
 };
 
 struct ltable_node {
@@ -43,15 +75,93 @@ struct ltable_node {
     /* follow vmemsz space*/
 };
 
+/*
+** frozen image: header, pilots, entries, array part, strings. it holds
+** offsets only, so it can be written out and mmapped back as is.
+*/
+#define FROZEN_MAGIC    0x5a46544c  /* "LTFZ" */
+#define FROZEN_VERSION  2
+
+struct frozen_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;              /* of the whole image */
+    uint64_t vmemsz;
+    uint64_t voff;
+    uint64_t entsz;             /* entry stride */
+    uint64_t seed;              /* of the perfect hash */
+    uint32_t nbucket;
+    uint32_t nentry;            /* entry slots, some are empty */
+    uint32_t sizearray;
+    uint32_t count;             /* entries, array part included */
+    uint64_t pilot;             /* offsets from image start */
+    uint64_t entry;
+    uint64_t array;
+    uint64_t str;
+};
+
+struct frozen_key {
+    int32_t type;
+    uint32_t len;
+    union {
+        double f;
+        int64_t i;
+        uint64_t p;
+        uint64_t off;           /* of string, from `str' */
+    } v;
+};
+
+/* entry: frozen_key, then struct ltable_value and value as in a node */
+#define FROZEN_VALOFF   sizeof(struct frozen_key)
+
+/* growable byte buffer of the change journal */
+struct jbuf {
+    char *p;
+    size_t n;
+    size_t cap;
+};
+
 struct ltable {
     size_t vmemsz;
+    size_t nodesz;              /* stride of `node' array */
+    size_t voff;                /* offset of value data in its slot */
+    int memflags;               /* LTABLE_MEM* */
+    int numanode;
     struct ltable_value *array;
+    struct ltable_value **seg;  /* segment directory, with LTABLE_MEMSEGMENT */
     struct ltable_node *node;
     int sizearray;
     uint8_t lsizenode;          /* log2 of size of `node' array */
     struct pool pool;
+    struct vpool vpool;
     unsigned int seed;
     int lastfree;
+    size_t count;               /* number of entries */
+    /* bounded cache mode, see ltable_setlimit */
+    bool bounded;
+    size_t maxcount;
+    size_t maxbytes;
+    ltable_evict_fn evict;
+    void *evictud;
+    int hand;                   /* clock hand, indexes array part then hash part */
+    /* negative lookup filter, see ltable_setfilter */
+    uint64_t *filter;
+    uint32_t fblocks;           /* power of 2 */
+    int fbits;                  /* bits per hash part slot */
+    int fk;                     /* bits set per key */
+    size_t fstale;              /* deletes since last rebuild */
+    bool fstats;                /* count below, lookups then write to the table */
+    size_t fqueries;
+    size_t frejects;
+    size_t ffalse;
+    /* frozen table, see ltable_freeze */
+    const struct frozen_header *frozen;
+    bool frozenowned;
+    /* change journal, see ltable_journal */
+    ltable_journal_fn journal;
+    void *journalud;
+    struct jbuf jpending;       /* queued records, without values */
+    struct jbuf jout;           /* records being flushed */
 };
 
 
@@ -64,8 +174,14 @@ struct ltable {
 #define gnext(n)    ((n)->next)
 #define sizenode(t)	(1 << ((t)->lsizenode))
 #define inarray(t, idx) ((idx)>=0 && (idx) < (t)->sizearray)
-#define nodememsz(t) (t->vmemsz + sizeof(struct ltable_node))
-#define valmemsz(t)  (t->vmemsz + sizeof(struct ltable_value))
+
+/* segmented array part: SEGSZ slots per segment */
+#define SEGBITS     16
+#define SEGSZ       (1 << SEGBITS)
+#define nseg(n)     (((n) + SEGSZ - 1) >> SEGBITS)
+#define nodememsz(t) ((t)->nodesz)
+#define valmemsz(t)  ((t)->vmemsz + (t)->voff)
+#define gval(t, v)   ((void*)((char*)(v) + (t)->voff))
 
 /*
 ** {=============================================================
@@ -75,8 +191,8 @@ struct ltable {
 
 static void
 pool_init(struct pool *p) {
-    p->node = NULL;
     p->freenode = NULL;
+    p->used = 0;
 }
 
 static void*
@@ -96,45 +212,247 @@ pool_alloc(struct pool *p, size_t sz) {
         n = (struct pool_node*)malloc(sz + sizeof(struct pool_node));
         n->nodesz = sz;
     }
-    n->next = p->node;
-    p->node = n;
+    p->used += n->nodesz + sizeof(struct pool_node);
     return n+1;
 }
 
 static void
 pool_free(struct pool *p, struct pool_node *node) {
-    struct pool_node **np = &p->node;
     node--;
-
-    while(*np) {
-        if (*np == node) {
-            *np = (*np)->next;
-            break;
-        }
-        np = &(*np)->next;
-    }
-
     node->next = p->freenode;
     p->freenode = node;
+    p->used -= node->nodesz + sizeof(struct pool_node);
 }
 
 static void
 pool_release(struct pool *p) {
     struct pool_node *nextn;
-    struct pool_node *n = p->node;
+    struct pool_node *n = p->freenode;
     while(n) {
         nextn = n->next;
         free(n);
         n = nextn;
     }
-    n = p->freenode;
-    while(n) {
-        nextn = n->next;
-        free(n);
-        n = nextn;
+}
+
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** Size-classed pool for out-of-line values
+** ==============================================================
+*/
+
+static void
+vpool_init(struct vpool *p) {
+    memset(p->freelist, 0, sizeof(p->freelist));
+    p->used = 0;
+}
+
+static size_t
+vpool_class(size_t sz) {
+    size_t l = VBLOCK_MINBITS;
+    while (((size_t)1 << l) < sz) l++;
+    return l;
+}
+
+static void*
+vpool_alloc(struct vpool *p, size_t sz) {
+    size_t l = vpool_class(sz);
+    struct vblock *b = p->freelist[l];
+    if (b) {
+        p->freelist[l] = b->next;
+    } else {
+        b = (struct vblock*)malloc(((size_t)1 << l) + sizeof(struct vblock));
+        b->lsize = l;
+    }
+    b->next = NULL;
+    p->used += ((size_t)1 << l) + sizeof(struct vblock);
+    return b+1;
+}
+
+static void
+vpool_free(struct vpool *p, void *ud) {
+    struct vblock *b = (struct vblock*)ud - 1;
+    b->next = p->freelist[b->lsize];
+    p->freelist[b->lsize] = b;
+    p->used -= ((size_t)1 << b->lsize) + sizeof(struct vblock);
+}
+
+static inline size_t
+vpool_size(void *ud) {
+    return ((struct vblock*)ud - 1)->size;
+}
+
+static void
+vpool_release(struct vpool *p) {
+    size_t l;
+    for (l=0; l<VBLOCK_NCLASS; l++) {
+        struct vblock *b = p->freelist[l];
+        while (b) {
+            struct vblock *nextb = b->next;
+            free(b);
+            b = nextb;
+        }
+    }
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** Memory for node and array parts
+** ==============================================================
+*/
+
+#define CACHELINE       64
+#define HUGEPAGE_SZ     (2*1024*1024)
+
+/* parts smaller than this always come from malloc */
+#define MAP_THRESHOLD   HUGEPAGE_SZ
+
+#define MEMMAP_FLAGS (LTABLE_MEMHUGE|LTABLE_MEMHUGETLB|LTABLE_MEMBIND|LTABLE_MEMINTERLEAVE)
+
+#ifndef MPOL_BIND
+#define MPOL_BIND               2
+#define MPOL_INTERLEAVE         3
+#define MPOL_F_MEMS_ALLOWED     (1<<2)
+#endif
+
+/*
+** values are aligned for any type of size `vmemsz': to the largest power
+** of two dividing it, at most 8. the value header is padded to that, and
+** as it sits at a multiple of 8 in a node, node values are aligned too.
+*/
+static size_t
+_voff(size_t vmemsz) {
+    size_t align = 1;
+    while (align < 8 && vmemsz && (vmemsz & align) == 0) align <<= 1;
+    return align;
+}
+
+/*
+** node stride: keep `next' pointers aligned, and with LTABLE_MEMALIGN
+** make sure no node straddles a cache line.
+*/
+static size_t
+_nodesz(const struct ltable *t) {
+    size_t sz = offsetof(struct ltable_node, value) + t->voff + t->vmemsz;
+    size_t align = sizeof(struct ltable_node*);
+    if (t->memflags & LTABLE_MEMALIGN) {
+        if (sz > CACHELINE)
+            align = CACHELINE;
+        else
+            while (align < sz) align <<= 1;
     }
+    return (sz + align - 1) & ~(align - 1);
+}
+
+static inline bool
+_usemap(int flags, size_t sz) {
+#ifdef LTABLE_USE_MMAP
+    return (flags & MEMMAP_FLAGS) && sz >= MAP_THRESHOLD;
+#else
+    return false;
+#endif
 }
 
+#ifdef LTABLE_USE_MMAP
+
+static inline size_t
+_maplen(size_t sz) {
+    return (sz + HUGEPAGE_SZ - 1) & ~((size_t)HUGEPAGE_SZ - 1);
+}
+
+static void
+_mapnuma(const struct ltable *t, void *p, size_t len) {
+    unsigned long mask[16];
+    unsigned long maxnode = sizeof(mask)*8;
+    memset(mask, 0, sizeof(mask));
+    if (t->memflags & LTABLE_MEMINTERLEAVE) {
+        if (syscall(SYS_get_mempolicy, NULL, mask, maxnode, NULL, MPOL_F_MEMS_ALLOWED) == 0)
+            syscall(SYS_mbind, p, len, MPOL_INTERLEAVE, mask, maxnode, 0);
+    } else if ((t->memflags & LTABLE_MEMBIND) &&
+               t->numanode >= 0 && (unsigned long)t->numanode < maxnode) {
+        mask[t->numanode / (sizeof(long)*8)] = 1UL << (t->numanode % (sizeof(long)*8));
+        syscall(SYS_mbind, p, len, MPOL_BIND, mask, maxnode, 0);
+    }
+    /* best effort: a failed mbind leaves the default policy */
+}
+
+static void*
+_mapalloc(const struct ltable *t, size_t sz) {
+    size_t len = _maplen(sz);
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (t->memflags & LTABLE_MEMHUGETLB)
+        p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {     /* no hugetlb pages reserved, use THP instead */
+        p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        if (t->memflags & (LTABLE_MEMHUGE|LTABLE_MEMHUGETLB))
+            madvise(p, len, MADV_HUGEPAGE);
+#endif
+    }
+    _mapnuma(t, p, len);       /* before any page is touched */
+    return p;
+}
+
+#endif /* LTABLE_USE_MMAP */
+
+static void*
+_memalloc(const struct ltable *t, size_t sz) {
+#ifdef LTABLE_USE_MMAP
+    if (_usemap(t->memflags, sz))
+        return _mapalloc(t, sz);
+#endif
+    if (t->memflags & LTABLE_MEMALIGN) {
+        void *p;
+        return posix_memalign(&p, CACHELINE, sz) == 0 ? p : NULL;
+    }
+    return malloc(sz);
+}
+
+/* `flags' are the memflags in effect when `p' was allocated */
+static void
+_memfree(int flags, void *p, size_t sz) {
+#ifdef LTABLE_USE_MMAP
+    if (_usemap(flags, sz)) {
+        munmap(p, _maplen(sz));
+        return;
+    }
+#endif
+    free(p);
+}
+
+static void*
+_memrealloc(const struct ltable *t, int oflags, void *p, size_t osz, size_t sz) {
+    bool omap = _usemap(oflags, osz);
+    bool map = _usemap(t->memflags, sz);
+    void *np;
+    if (!omap && !map)
+        return realloc(p, sz);
+#ifdef LTABLE_USE_MMAP
+    if (omap && map && oflags == t->memflags && !(oflags & LTABLE_MEMHUGETLB)) {
+        np = mremap(p, _maplen(osz), _maplen(sz), MREMAP_MAYMOVE);
+        return np == MAP_FAILED ? NULL : np;
+    }
+#endif
+    np = _memalloc(t, sz);
+    if (np && p)
+        memcpy(np, p, osz < sz ? osz : sz);
+    if (p)
+        _memfree(oflags, p, osz);
+    return np;
+}
 
 /*
 ** }=============================================================
@@ -150,8 +468,20 @@ isnilnode(const struct ltable_node *n) {
     return isnil(&n->value);
 }
 
+/*
+** deleted nodes may still be linked in a collision chain, so only nodes
+** never used since the hash part was built are free positions.
+*/
+static inline bool
+isfreenode(const struct ltable_node *n) {
+    return isnilnode(n) && n->key.type == 0;
+}
+
 static inline struct ltable_value*
 _garray(const struct ltable* t, int idx) {
+    if (t->memflags & LTABLE_MEMSEGMENT)
+        return (struct ltable_value*)(((char*)t->seg[idx >> SEGBITS]) +
+                                      valmemsz(t)*(idx & (SEGSZ-1)));
     return (struct ltable_value*)(((char*)t->array) + valmemsz(t)*idx);
 }
 
@@ -161,8 +491,8 @@ _gnode(const struct ltable* t, int idx) {
 }
 
 static inline struct ltable_node*
-_gnodex(const struct ltable*t, int idx, void* n) {
-    return (struct ltable_node*)(((char*)n) + nodememsz(t)*idx);
+_gnodex(size_t nodesz, int idx, void* n) {
+    return (struct ltable_node*)(((char*)n) + nodesz*idx);
 }
 
 static inline void
@@ -176,11 +506,67 @@ _cpynode(struct ltable *t, struct ltable_node *dest, const struct ltable_node *s
 }
 
 static inline void*
-_gud(struct ltable_value* v) {
+_outval(const struct ltable *t, const struct ltable_value *v) {
+    void *ud;
+    memcpy(&ud, gval(t, v), sizeof(ud));
+    return ud;
+}
+
+static inline void*
+_gud(const struct ltable *t, struct ltable_value* v) {
     if (v == NULL || isnil(v))
         return NULL;
+    else if (v->outline)
+        return _outval(t, v);
     else
-        return v+1;
+        return gval(t, v);
+}
+
+/* bytes asked for by ltable_set_sized, vmemsz for inline values */
+static inline size_t
+_valsize(const struct ltable *t, const struct ltable_value *v) {
+    return v->outline ? vpool_size(_outval(t, v)) : t->vmemsz;
+}
+
+static inline void
+_freeval(struct ltable *t, struct ltable_value *v) {
+    if (v->outline) {
+        vpool_free(&t->vpool, _outval(t, v));
+        v->outline = false;
+    }
+}
+
+/*
+** make room for `sz' bytes in value `v', keeping its first bytes.
+** values fit in `vmemsz' stay inline, others move to a vblock.
+*/
+static void*
+_sizeval(struct ltable *t, struct ltable_value *v, size_t sz) {
+    void *old = _gud(t, v);
+    size_t osz = v->outline ? vpool_size(old) : t->vmemsz;
+    void *ud;
+
+    if (sz <= t->vmemsz) {
+        if (v->outline) {
+            memcpy(gval(t, v), old, sz);
+            vpool_free(&t->vpool, old);
+            v->outline = false;
+        }
+        return gval(t, v);
+    }
+    if (v->outline && vpool_class(sz) == vpool_class(osz)) {
+        ((struct vblock*)old - 1)->size = sz;
+        return old;
+    }
+
+    ud = vpool_alloc(&t->vpool, sz);
+    ((struct vblock*)ud - 1)->size = sz;
+    memcpy(ud, old, osz < sz ? osz : sz);
+    if (v->outline)
+        vpool_free(&t->vpool, old);
+    memcpy(gval(t, v), &ud, sizeof(ud));
+    v->outline = true;
+    return ud;
 }
 
 static struct ltable_node*
@@ -234,9 +620,9 @@ void
 _cpykey(struct ltable *t, struct ltable_key *dest, const struct ltable_key *src) {
     *dest = *src;
     if (dest->type == LTABLE_KEYSTR) {
-        size_t l = strlen(src->v.s)+1;
-        char *sp = pool_alloc(&t->pool, l);
-        memcpy(sp, src->v.s, l);
+        char *sp = pool_alloc(&t->pool, src->len+1);
+        memcpy(sp, src->v.s, src->len);
+        sp[src->len] = '\0';
         dest->v.s = sp;
     }
 }
@@ -248,7 +634,7 @@ _eqkey(const struct ltable_key *key, const struct ltable_key *nkey) {
 
     switch (key->type) {
     case LTABLE_KEYSTR:
-        return !strcmp(key->v.s, nkey->v.s);
+        return key->len == nkey->len && !memcmp(key->v.s, nkey->v.s, key->len);
     case LTABLE_KEYINT:
         return key->v.i == nkey->v.i;
     case LTABLE_KEYNUM:
@@ -259,8 +645,7 @@ _eqkey(const struct ltable_key *key, const struct ltable_key *nkey) {
 }
 
 unsigned int
-_strhash (const char *str, unsigned int seed) {
-    size_t l = strlen(str);
+_strhash (const char *str, size_t l, unsigned int seed) {
     unsigned int h = seed ^ ((unsigned int)l);
     size_t l1;
     size_t step = (l >> STR_HASHLIMIT) + 1;
@@ -269,16 +654,14 @@ _strhash (const char *str, unsigned int seed) {
     return h;
 }
 
+/* mix all 64 bits, the node index takes the low bits of the hash */
 unsigned int
 _numhash (union ltable_Hash *u) {
-    int i = u->l_p[0] + u->l_p[1] + u->l_p[2] + u->l_p[3];
-
-    if (i < 0) {
-        if (((unsigned int)i) == 0u - i)  /* use unsigned to avoid overflows */
-            i = 0;  /* handle INT_MIN */
-        i = -i;  /* must be a positive value */
-    }
-    return i;
+    uint64_t x = u->l;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned int)x;
 }
 
 /*
@@ -287,8 +670,8 @@ _numhash (union ltable_Hash *u) {
 */
 static int
 arrayindex (const struct ltable_key *key) {
-  if (key->type == LTABLE_KEYINT) {
-      return key->v.i;
+  if (key->type == LTABLE_KEYINT && key->v.i >= 0 && key->v.i <= MAXASIZE) {
+      return (int)key->v.i;
   }
   return -1;  /* `key' did not match some condition */
 }
@@ -297,14 +680,14 @@ static struct ltable_node *
 mainposition(struct ltable* t, const struct ltable_key* key) {
     unsigned int h;
     if (key->type == LTABLE_KEYSTR)
-        h = _strhash(key->v.s, t->seed);
+        h = _strhash(key->v.s, key->len, t->seed);
     else {
         union ltable_Hash u;
         memset(&u, 0, sizeof(u));
 
         switch(key->type) {
         case LTABLE_KEYNUM:
-            u.f = key->v.f; break;
+            u.f = key->v.f == 0 ? 0 : key->v.f; break; /* -0 == 0 */
         case LTABLE_KEYINT:
             u.i = key->v.i; break;
         default:                /* LTABLE_KEYOBJ  */
@@ -320,7 +703,7 @@ static struct ltable_node*
 _getfreepos(struct ltable* t) {
     while (t->lastfree > 0) {
         t->lastfree--;
-        if (isnilnode(_gnode(t, t->lastfree)))
+        if (isfreenode(_gnode(t, t->lastfree)))
             return _gnode(t, t->lastfree);
     }
     return NULL;  /* could not find a free place */
@@ -338,6 +721,186 @@ _hashget(struct ltable* t, const struct ltable_key * key) {
     return node;
 }
 
+/*
+** {=============================================================
+** Frozen lookup
+** ==============================================================
+*/
+
+static inline uint64_t
+_fmix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* full 64-bit hash of a key, whole string included */
+static uint64_t
+_keyhash(const struct ltable_key *key, uint64_t seed) {
+    uint64_t h;
+    seed += (uint64_t)key->type * 0x9e3779b97f4a7c15ULL;
+    if (key->type == LTABLE_KEYSTR) {
+        const uint8_t *s = (const uint8_t*)key->v.s;
+        unsigned int i;
+        h = 0xcbf29ce484222325ULL;      /* FNV-1a */
+        for (i=0; i<key->len; i++)
+            h = (h ^ s[i]) * 0x100000001b3ULL;
+    } else {
+        union ltable_Hash u;
+        memset(&u, 0, sizeof(u));
+        switch(key->type) {
+        case LTABLE_KEYNUM:
+            u.f = key->v.f == 0 ? 0 : key->v.f; break;
+        case LTABLE_KEYINT:
+            u.i = key->v.i; break;
+        default:                /* LTABLE_KEYOBJ  */
+            u.p = key->v.p; break;
+        }
+        h = u.l;
+    }
+    return _fmix64(h ^ seed);
+}
+
+/* map 32 random bits onto [0, n) */
+#define fastrange(x, n)  ((uint32_t)(((uint64_t)(uint32_t)(x) * (n)) >> 32))
+
+#define fbucket(f, h)       fastrange((h) >> 32, (f)->nbucket)
+#define fposition(h, p, n)  fastrange(_fmix64((h) + (p) * 0x9e3779b97f4a7c15ULL), (n))
+#define fpilots(f)          ((const uint32_t*)((const char*)(f) + (f)->pilot))
+#define fentry(f, i)        ((struct frozen_key*)((char*)(f) + (f)->entry + (f)->entsz*(i)))
+#define fstr(f, k)          ((const char*)(f) + (f)->str + (k)->v.off)
+
+static bool
+_frozeneq(const struct frozen_header *f, const struct frozen_key *fk,
+          const struct ltable_key *key) {
+    if (fk->type != key->type)
+        return false;
+    switch (key->type) {
+    case LTABLE_KEYSTR:
+        return fk->len == key->len && !memcmp(fstr(f, fk), key->v.s, key->len);
+    case LTABLE_KEYINT:
+        return fk->v.i == key->v.i;
+    case LTABLE_KEYNUM:
+        return fk->v.f == key->v.f;
+    default:                    /* keyobj */
+        return fk->v.p == (uint64_t)(uintptr_t)key->v.p;
+    }
+}
+
+/* one probe, one key comparison */
+static struct ltable_value *
+_frozenget(const struct ltable *t, const struct ltable_key *key) {
+    const struct frozen_header *f = t->frozen;
+    uint64_t h;
+    struct frozen_key *fk;
+    if (f->nentry == 0)
+        return NULL;
+    h = _keyhash(key, f->seed);
+    fk = fentry(f, fposition(h, fpilots(f)[fbucket(f, h)], f->nentry));
+    if (!_frozeneq(f, fk, key))
+        return NULL;
+    return (struct ltable_value*)((char*)fk + FROZEN_VALOFF);
+}
+
+static void
+_frozenkey(const struct frozen_header *f, const struct frozen_key *fk,
+           struct ltable_key *key) {
+    key->type = fk->type;
+    key->len = fk->len;
+    switch (fk->type) {
+    case LTABLE_KEYSTR:
+        key->v.s = fstr(f, fk); break;
+    case LTABLE_KEYINT:
+        key->v.i = fk->v.i; break;
+    case LTABLE_KEYNUM:
+        key->v.f = fk->v.f; break;
+    default:
+        key->v.p = (const void*)(uintptr_t)fk->v.p; break;
+    }
+}
+
+/*
+** }=============================================================
+*/
+
+/*
+** {=============================================================
+** Negative lookup filter
+** ==============================================================
+*/
+
+/*
+** blocked Bloom filter over the keys of the hash part: all bits of a
+** key are in one 512-bit block, a single cache line. keys can't be
+** removed, so deletes are counted and the filter is rebuilt when they
+** pile up, and on every resize.
+*/
+#define FBLOCK_WORDS    8
+#define FBLOCK_BITS     (FBLOCK_WORDS*64)
+
+static inline uint64_t
+_fhash(const struct ltable *t, const struct ltable_key *key) {
+    return _keyhash(key, t->seed);
+}
+
+static inline uint64_t*
+_fblock(const struct ltable *t, uint64_t h) {
+    return t->filter + FBLOCK_WORDS * ((uint32_t)(h >> 32) & (t->fblocks - 1));
+}
+
+static void
+_fadd(struct ltable *t, const struct ltable_key *key) {
+    uint64_t h = _fhash(t, key);
+    uint64_t *b = _fblock(t, h);
+    uint32_t x = (uint32_t)h, step = (uint32_t)(h >> 32) | 1;
+    int i;
+    for (i=0; i<t->fk; i++, x += step)
+        b[(x >> 23) & 7] |= 1ULL << ((x >> 26) & 63);
+}
+
+static inline bool
+_fmaybe(const struct ltable *t, const struct ltable_key *key) {
+    uint64_t h = _fhash(t, key);
+    const uint64_t *b = _fblock(t, h);
+    uint32_t x = (uint32_t)h, step = (uint32_t)(h >> 32) | 1;
+    int i;
+    for (i=0; i<t->fk; i++, x += step)
+        if (!(b[(x >> 23) & 7] & (1ULL << ((x >> 26) & 63))))
+            return false;
+    return true;
+}
+
+static void
+_frebuild(struct ltable *t) {
+    size_t bits = (size_t)sizenode(t) * t->fbits;
+    uint32_t n = 1;
+    int i;
+    while ((size_t)n * FBLOCK_BITS < bits) n <<= 1;
+    if (n != t->fblocks) {
+        free(t->filter);
+        if (posix_memalign((void**)&t->filter, CACHELINE, (size_t)n * FBLOCK_BITS / 8)) {
+            t->filter = NULL;   /* out of memory: run without filter */
+            t->fblocks = 0;
+            return;
+        }
+        t->fblocks = n;
+    }
+    memset(t->filter, 0, (size_t)n * FBLOCK_BITS / 8);
+    for (i=0; i<sizenode(t); i++) {
+        struct ltable_node *node = _gnode(t, i);
+        if (!isnilnode(node))
+            _fadd(t, &node->key);
+    }
+    t->fstale = 0;
+}
+
+/*
+** }=============================================================
+*/
+
 static struct ltable_value *
 _get(struct ltable* t, const struct ltable_key * key) {
     int idx = arrayindex(key);
@@ -345,8 +908,21 @@ _get(struct ltable* t, const struct ltable_key * key) {
         struct ltable_value* val = _garray(t, idx);
         return isnil(val) ? NULL : val;
     }
+    if (t->frozen)
+        return _frozenget(t, key);
+    if (t->filter && !_fmaybe(t, key)) {
+        if (t->fstats) {
+            t->fqueries++;
+            t->frejects++;
+        }
+        return NULL;
+    }
 
     struct ltable_node *node = _hashget(t, key);
+    if (t->fstats) {
+        t->fqueries++;
+        if (!node) t->ffalse++;
+    }
     return node ? &node->value : NULL;    
 }
 
@@ -376,8 +952,10 @@ _hashset(struct ltable* t, const struct ltable_key *key) {
             mp = freen;
         }
     }
-    _cpykey(t, &mp->key, key);
+    mp->key = *key;             /* caller owns string copy, see _insert */
     mp->value.setted = true;
+    mp->value.outline = false;  /* may still carry the moved node's flags */
+    mp->value.ref = false;
     return &mp->value;
 }
 
@@ -393,6 +971,284 @@ _set(struct ltable* t, const struct ltable_key *key) {
     }
 }
 
+/*
+** {=============================================================
+** Change journal
+** ==============================================================
+*/
+
+/*
+** records, native byte order, no padding:
+**   LTABLE_JSET     op:u8 key vlen:u32 value
+**   LTABLE_JDEL     op:u8 key
+**   LTABLE_JRESIZE  op:u8 nasize:i32 nhsize:i32
+** a key is type:u8, then len:u32 and the bytes of a string, or 8 bytes.
+**
+** the caller writes a value after ltable_set returns, so only op and
+** key are queued, and values are read at flush. a key set again before
+** the flush is queued once, while its value is `dirty'.
+*/
+#define JOURNAL_CHUNK   (64*1024)
+
+static void
+_jput(struct jbuf *b, const void *p, size_t sz) {
+    if (b->n + sz > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->n + sz) cap *= 2;
+        b->p = realloc(b->p, cap);
+        b->cap = cap;
+    }
+    memcpy(b->p + b->n, p, sz);
+    b->n += sz;
+}
+
+static void
+_jputkey(struct jbuf *b, uint8_t op, const struct ltable_key *key) {
+    uint8_t type = key->type;
+    _jput(b, &op, 1);
+    _jput(b, &type, 1);
+    if (key->type == LTABLE_KEYSTR) {
+        uint32_t len = key->len;
+        _jput(b, &len, 4);
+        _jput(b, key->v.s, len);
+    } else {
+        _jput(b, &key->v, 8);
+    }
+}
+
+/* decode a key at `p', NULL if malformed. strings point into the buffer */
+static const char*
+_jgetkey(const char *p, const char *end, struct ltable_key *key) {
+    uint32_t len;
+    if (end - p < 1)
+        return NULL;
+    key->type = (uint8_t)*p++;
+    key->len = 0;
+    switch (key->type) {
+    case LTABLE_KEYSTR:
+        if (end - p < 4)
+            return NULL;
+        memcpy(&len, p, 4);
+        p += 4;
+        if ((size_t)(end - p) < len)
+            return NULL;
+        key->len = len;
+        key->v.s = p;
+        return p + len;
+    case LTABLE_KEYNUM: case LTABLE_KEYINT: case LTABLE_KEYOBJ:
+        if (end - p < 8)
+            return NULL;
+        memcpy(&key->v, p, 8);
+        return p + 8;
+    default:
+        return NULL;
+    }
+}
+
+static inline void
+_jset(struct ltable *t, const struct ltable_key *key, struct ltable_value *val) {
+    if (!val->dirty) {
+        val->dirty = true;
+        _jputkey(&t->jpending, LTABLE_JSET, key);
+    }
+}
+
+static void
+_jemit(struct ltable *t) {
+    if (t->jout.n) {
+        t->journal(t->journalud, t->jout.p, t->jout.n);
+        t->jout.n = 0;
+    }
+}
+
+/* lookup past the filter, so flushes don't show in its stats */
+static struct ltable_value *
+_jget(struct ltable *t, const struct ltable_key *key) {
+    int idx = arrayindex(key);
+    struct ltable_node *node;
+    if (inarray(t, idx)) {
+        struct ltable_value *val = _garray(t, idx);
+        return isnil(val) ? NULL : val;
+    }
+    node = _hashget(t, key);
+    return node ? &node->value : NULL;
+}
+
+static void
+_jflush(struct ltable *t) {
+    const char *p = t->jpending.p, *end = p + t->jpending.n;
+    while (p < end) {
+        const char *rec = p;
+        struct ltable_key key;
+        struct ltable_value *val;
+        if (*p == LTABLE_JRESIZE) {
+            p += 9;
+            _jput(&t->jout, rec, p - rec);
+        } else {
+            p = _jgetkey(p + 1, end, &key);
+            val = _jget(t, &key);
+            if (*rec == LTABLE_JDEL) {
+                _jput(&t->jout, rec, p - rec);
+                /* set again since the del, its record comes later */
+                if (val) val->dirty = true;
+            } else if (val && val->dirty) {
+                void *ud = _gud(t, val);
+                uint32_t vlen = _valsize(t, val);
+                val->dirty = false;
+                _jput(&t->jout, rec, p - rec);
+                _jput(&t->jout, &vlen, 4);
+                _jput(&t->jout, ud, vlen);
+            }
+        }
+        if (t->jout.n >= JOURNAL_CHUNK)
+            _jemit(t);
+    }
+    _jemit(t);
+    t->jpending.n = 0;
+}
+
+/* drop queued records */
+static void
+_jreset(struct ltable *t) {
+    int i;
+    t->jpending.n = 0;
+    for (i=0; i<t->sizearray; i++)
+        _garray(t, i)->dirty = false;
+    for (i=0; i<sizenode(t); i++)
+        _gnode(t, i)->value.dirty = false;
+}
+
+/*
+** }=============================================================
+*/
+
+static void
+_delnode(struct ltable *t, struct ltable_node *node) {
+    _freeval(t, &node->value);
+    node->value.setted = false;
+    if (node->key.type == LTABLE_KEYSTR) {
+        /* free string key */
+        pool_free(&t->pool, (struct pool_node*)node->key.v.s);
+        node->key.v.s = NULL;
+    }
+    t->count--;
+    if (t->filter && ++t->fstale > t->count/2 + 64)
+        _frebuild(t);
+}
+
+/* give the string keys of live nodes back to the pool */
+static void
+_freekeys(struct ltable *t) {
+    int i;
+    for (i=0; i<sizenode(t); i++) {
+        struct ltable_node *n = _gnode(t, i);
+        if (n->value.setted && n->key.type == LTABLE_KEYSTR)
+            pool_free(&t->pool, (struct pool_node*)n->key.v.s);
+    }
+}
+
+static void
+_delarray(struct ltable *t, struct ltable_value *val) {
+    _freeval(t, val);
+    val->setted = false;
+    t->count--;
+}
+
+/*
+** {=============================================================
+** Eviction
+** ==============================================================
+*/
+
+/* bytes charged against `maxbytes' */
+static inline size_t
+_charge(const struct ltable *t) {
+    return t->count * nodememsz(t) + t->pool.used + t->vpool.used;
+}
+
+static inline bool
+_overlimit(const struct ltable *t, size_t n, size_t bytes) {
+    return (t->maxcount && t->count + n > t->maxcount) ||
+        (t->maxbytes && _charge(t) + bytes > t->maxbytes);
+}
+
+/*
+** CLOCK: sweep the hand over all slots, clearing `ref' bits and evicting
+** the first entry not read since the last pass, until `n' more entries
+** and `bytes' more bytes fit. `keep' is never evicted.
+*/
+static void
+_evict(struct ltable *t, size_t n, size_t bytes, const struct ltable_value *keep) {
+    int total = t->sizearray + sizenode(t);
+    int scanned = 0;
+    while (_overlimit(t, n, bytes) && scanned++ < 2*total) {
+        struct ltable_key key;
+        struct ltable_value *val;
+        struct ltable_node *node = NULL;
+        if (t->hand >= total) t->hand = 0;
+        if (t->hand < t->sizearray) {
+            val = _garray(t, t->hand);
+            ltable_intkey(&key, t->hand);
+        } else {
+            node = _gnode(t, t->hand - t->sizearray);
+            val = &node->value;
+            key = node->key;
+        }
+        t->hand++;
+        if (isnil(val) || val == keep)
+            continue;
+        if (val->ref) {
+            val->ref = false;
+            continue;
+        }
+        if (t->evict)
+            t->evict(t->evictud, &key, _gud(t, val));
+        if (t->journal)
+            _jputkey(&t->jpending, LTABLE_JDEL, &key);
+        if (node)
+            _delnode(t, node);
+        else
+            _delarray(t, val);
+    }
+}
+
+/* bytes a new entry for `key' with `sz' bytes value will be charged */
+static size_t
+_newcharge(const struct ltable *t, const struct ltable_key *key, size_t sz) {
+    size_t bytes = nodememsz(t);
+    if (key->type == LTABLE_KEYSTR) {
+        size_t l = key->len + 1;
+        bytes += (l < SHORTSTR_LEN ? SHORTSTR_LEN : l) + sizeof(struct pool_node);
+    }
+    if (sz > t->vmemsz)
+        bytes += ((size_t)1 << vpool_class(sz)) + sizeof(struct vblock);
+    return bytes;
+}
+
+/* insert a missing `key', evicting others first if the table is bounded */
+static struct ltable_value *
+_insert(struct ltable *t, const struct ltable_key *key, size_t sz) {
+    struct ltable_value *val;
+    if (t->bounded)
+        _evict(t, 1, _newcharge(t, key, sz), NULL);
+    val = _set(t, key);
+    if (!inarray(t, arrayindex(key))) {
+        struct ltable_node *node = (struct ltable_node*)
+            ((char*)val - offsetof(struct ltable_node, value));
+        _cpykey(t, &node->key, key);
+        if (t->filter)
+            _fadd(t, key);
+    }
+    val->ref = false;
+    val->dirty = false;
+    t->count++;
+    return val;
+}
+
+/*
+** }=============================================================
+*/
+
 /*
 ** {=============================================================
 ** Rehash
@@ -475,22 +1331,93 @@ _resize_node(struct ltable *t, int size) {
     if (lsize > MAXBITS)
         assert(0);
     size = twoto(lsize);
-    int memsz = nodememsz(t)*size;
-    t->node = malloc(memsz);
+    size_t memsz = nodememsz(t)*size;
+    t->node = _memalloc(t, memsz);
     memset(t->node, 0, memsz);
     t->lsizenode = (uint8_t)lsize;
     t->lastfree = size; /* all positions are free */
 }
 
+/* bytes of segment `i' for an array part of `n' slots */
+static inline size_t
+_segsz(const struct ltable *t, int n, int i) {
+    int l = n - i*SEGSZ;
+    if (l <= 0) return 0;
+    return valmemsz(t) * (l < SEGSZ ? l : SEGSZ);
+}
+
+/*
+** only the last, partial segment is ever reallocated, so growth never
+** copies more than one segment and existing slots stay in place.
+*/
+static void
+_resize_segments(struct ltable *t, int nasize) {
+    int oldasize = t->sizearray;
+    int onseg = nseg(oldasize);
+    int n = nseg(nasize);
+    int i;
+
+    for (i = n; i < onseg; i++)
+        _memfree(t->memflags, t->seg[i], _segsz(t, oldasize, i));
+    if (n != onseg) {
+        if (n == 0) {
+            free(t->seg);
+            t->seg = NULL;
+        } else {
+            t->seg = realloc(t->seg, sizeof(struct ltable_value*) * n);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        size_t osz = i < onseg ? _segsz(t, oldasize, i) : 0;
+        size_t sz = _segsz(t, nasize, i);
+        if (osz == sz)
+            continue;
+        t->seg[i] = _memrealloc(t, t->memflags, osz ? t->seg[i] : NULL, osz, sz);
+        if (sz > osz) /* set growed part to zero */
+            memset((char*)t->seg[i] + osz, 0, sz - osz);
+    }
+    t->sizearray = nasize;
+}
+
+static void
+_free_array(struct ltable *t) {
+    int i;
+    if (t->memflags & LTABLE_MEMSEGMENT) {
+        for (i = 0; i < nseg(t->sizearray); i++)
+            _memfree(t->memflags, t->seg[i], _segsz(t, t->sizearray, i));
+        free(t->seg);
+    } else {
+        _memfree(t->memflags, t->array, valmemsz(t) * t->sizearray);
+    }
+}
+
 void
 _resize_array(struct ltable *t, int nasize) {
     int oldasize = t->sizearray;
+    if (t->memflags & LTABLE_MEMSEGMENT) {
+        _resize_segments(t, nasize);
+        return;
+    }
     t->sizearray = nasize;
-    t->array = realloc(t->array, valmemsz(t) * nasize);
+    t->array = _memrealloc(t, t->memflags, t->array,
+                           valmemsz(t) * oldasize, valmemsz(t) * nasize);
     if(nasize > oldasize) /* set growed part to zero */
         memset(_garray(t, oldasize), 0, valmemsz(t) * (nasize-oldasize));
 }
 
+/* re-insert nodes of an old hash part */
+static void
+_reinsert(struct ltable *t, struct ltable_node *nold, int oldsize, size_t oldnodesz) {
+    int i;
+    for (i = oldsize - 1; i >= 0; i--) {
+        struct ltable_node *old = _gnodex(oldnodesz, i, nold);
+        if (!isnilnode(old)) {
+            struct ltable_value *val = _set(t, &old->key);
+            _cpyval(t, val, &old->value);
+        }
+    }
+}
+
 void
 _resize(struct ltable *t, int nasize, int nhsize) {
     int i;
@@ -498,6 +1425,13 @@ _resize(struct ltable *t, int nasize, int nhsize) {
     int oldhsize = t->lsizenode;
 
     struct ltable_node *nold = t->node;  /* save old hash ... */
+    size_t inarr = 0;
+
+    /* the hash part must hold all entries left out of the array part */
+    for (i=0; i<t->sizearray && i<nasize; i++)
+        if (!isnil(_garray(t, i))) inarr++;
+    if ((size_t)nhsize < t->count - inarr)
+        nhsize = (int)(t->count - inarr);
 
     /* resize hash part */
     _resize_node(t, nhsize);
@@ -519,16 +1453,12 @@ _resize(struct ltable *t, int nasize, int nhsize) {
 
     /* re-insert elements from hash part */
     if (nold != NULL) {         /* not in init? */
-        for (i = twoto(oldhsize) - 1; i >= 0; i--) {
-            struct ltable_node *old = _gnodex(t, i, nold);
-            if (!isnilnode(old)) {
-                struct ltable_value *val = _set(t, &old->key);
-                _cpyval(t, val, &old->value);
-            }
-        }
+        _reinsert(t, nold, twoto(oldhsize), nodememsz(t));
         /* free old hash part */
-        free(nold);
+        _memfree(t->memflags, nold, nodememsz(t) * twoto(oldhsize));
     }
+    if (t->filter)
+        _frebuild(t);
 }
 
 
@@ -556,18 +1486,281 @@ _rehash(struct ltable* t, const struct ltable_key *ek) {
 */
 
 
+/*
+** {=============================================================
+** Freeze
+** ==============================================================
+*/
+
+/* smaller buckets make pilots easier to find, at 4 bytes per bucket */
+#define FROZEN_BUCKETSZ     4
+#define FROZEN_MAXPILOT     (1u << 26)
+#define FROZEN_ATTEMPTS     8
+/*
+** one spare entry slot per FROZEN_SLACK keys (load factor ~0.99): with
+** no free slot left, the last buckets would need ~n pilots each.
+*/
+#define FROZEN_SLACK        100
+
+#define align8(x)  (((x) + 7) & ~(uint64_t)7)
+
+/*
+** PTHash-style perfect hash: keys are split into buckets, and buckets,
+** biggest first, each search a pilot sending all their keys to distinct
+** free positions among `nslot'. fills `pos' (per key) and `pilot' (per
+** bucket).
+*/
+static bool
+_mphbuild(const uint64_t *hash, uint32_t n, uint32_t nslot, uint32_t nbucket,
+          uint32_t *pilot, uint32_t *pos) {
+    uint32_t *bstart = calloc(nbucket + 1, sizeof(uint32_t));
+    uint32_t *bkeys = malloc(sizeof(uint32_t) * (n ? n : 1));
+    uint32_t *order = malloc(sizeof(uint32_t) * nbucket);
+    uint32_t *sizecnt = NULL;
+    uint64_t *taken = calloc(nslot / 64 + 1, sizeof(uint64_t));    /* bitmap, stays in cache */
+    uint32_t maxsz = 0, i, j, b;
+    bool ok = true;
+
+    struct frozen_header f;     /* only nbucket is used by fbucket */
+    f.nbucket = nbucket;
+
+    /* group keys by bucket */
+    for (i=0; i<n; i++)
+        bstart[fbucket(&f, hash[i]) + 1]++;
+    for (b=0; b<nbucket; b++) {
+        if (bstart[b+1] > maxsz) maxsz = bstart[b+1];
+        bstart[b+1] += bstart[b];
+    }
+    {
+        uint32_t *fill = malloc(sizeof(uint32_t) * nbucket);
+        memcpy(fill, bstart, sizeof(uint32_t) * nbucket);
+        for (i=0; i<n; i++)
+            bkeys[fill[fbucket(&f, hash[i])]++] = i;
+        free(fill);
+    }
+
+    /* order buckets by size, biggest first */
+    sizecnt = calloc(maxsz + 2, sizeof(uint32_t));
+    for (b=0; b<nbucket; b++)
+        sizecnt[maxsz - (bstart[b+1] - bstart[b]) + 1]++;
+    for (i=0; i<=maxsz; i++)
+        sizecnt[i+1] += sizecnt[i];
+    for (b=0; b<nbucket; b++)
+        order[sizecnt[maxsz - (bstart[b+1] - bstart[b])]++] = b;
+
+    for (i=0; i<nbucket && ok; i++) {
+        uint32_t p;
+        uint32_t *k;
+        uint32_t sz;
+        b = order[i];
+        k = bkeys + bstart[b];
+        sz = bstart[b+1] - bstart[b];
+        pilot[b] = 0;
+        if (sz == 0)
+            continue;
+        for (p=0; p<FROZEN_MAXPILOT; p++) {
+            for (j=0; j<sz; j++) {
+                uint32_t l;
+                pos[k[j]] = fposition(hash[k[j]], p, nslot);
+                if (taken[pos[k[j]] >> 6] >> (pos[k[j]] & 63) & 1)
+                    break;
+                for (l=0; l<j && pos[k[l]] != pos[k[j]]; l++);
+                if (l < j)
+                    break;
+            }
+            if (j == sz)
+                break;
+        }
+        if (p == FROZEN_MAXPILOT) {
+            ok = false;         /* equal hashes, retry with another seed */
+            break;
+        }
+        pilot[b] = p;
+        for (j=0; j<sz; j++)
+            taken[pos[k[j]] >> 6] |= 1ULL << (pos[k[j]] & 63);
+    }
+
+    free(bstart);
+    free(bkeys);
+    free(order);
+    free(sizecnt);
+    free(taken);
+    return ok;
+}
+
+static void
+_frozen_attach(struct ltable *t, const struct frozen_header *f, bool owned) {
+    t->frozen = f;
+    t->frozenowned = owned;
+    t->memflags = 0;
+    t->array = (struct ltable_value*)((char*)f + f->array);
+    t->seg = NULL;
+    t->sizearray = f->sizearray;
+    t->node = NULL;
+    t->lsizenode = 0;
+    t->lastfree = 0;
+    t->count = f->count;
+    t->bounded = false;
+}
+
+static int
+_freeze(struct ltable *t) {
+    uint32_t n = 0, nslot, nbucket, i;
+    uint64_t *hash;
+    uint32_t *pos, *pilot;
+    struct ltable_node **nodes;
+    size_t strsz = 0, entsz, total;
+    uint64_t seed = t->seed;
+    int attempt;
+    struct frozen_header *f;
+    char *sp;
+
+    for (i=0; i<(uint32_t)t->sizearray; i++)
+        if (_garray(t, i)->outline)
+            return -1;
+    for (i=0; i<(uint32_t)sizenode(t); i++) {
+        struct ltable_node *node = _gnode(t, i);
+        if (isnilnode(node))
+            continue;
+        if (node->value.outline)
+            return -1;
+        n++;
+        if (node->key.type == LTABLE_KEYSTR)
+            strsz += node->key.len + 1;
+    }
+
+    nodes = malloc(sizeof(struct ltable_node*) * (n ? n : 1));
+    hash = malloc(sizeof(uint64_t) * (n ? n : 1));
+    pos = malloc(sizeof(uint32_t) * (n ? n : 1));
+    nslot = n ? n + n / FROZEN_SLACK + 1 : 0;
+    nbucket = n / FROZEN_BUCKETSZ + 1;
+    pilot = malloc(sizeof(uint32_t) * nbucket);
+    n = 0;
+    for (i=0; i<(uint32_t)sizenode(t); i++)
+        if (!isnilnode(_gnode(t, i)))
+            nodes[n++] = _gnode(t, i);
+
+    for (attempt=0; attempt<FROZEN_ATTEMPTS; attempt++) {
+        seed = _fmix64(seed + attempt);
+        for (i=0; i<n; i++)
+            hash[i] = _keyhash(&nodes[i]->key, seed);
+        if (_mphbuild(hash, n, nslot, nbucket, pilot, pos))
+            break;
+    }
+    if (attempt == FROZEN_ATTEMPTS) {
+        free(nodes); free(hash); free(pos); free(pilot);
+        return -1;
+    }
+
+    /* lay out the image */
+    entsz = align8(FROZEN_VALOFF + t->voff + t->vmemsz);
+    total = align8(sizeof(struct frozen_header));
+    f = NULL;
+    {
+        uint64_t opilot = total;
+        uint64_t oentry = align8(opilot + sizeof(uint32_t) * nbucket);
+        uint64_t oarray = align8(oentry + entsz * nslot);
+        uint64_t ostr = align8(oarray + valmemsz(t) * t->sizearray);
+        total = align8(ostr + strsz);
+        f = calloc(1, total);
+        f->pilot = opilot;
+        f->entry = oentry;
+        f->array = oarray;
+        f->str = ostr;
+    }
+    f->magic = FROZEN_MAGIC;
+    f->version = FROZEN_VERSION;
+    f->size = total;
+    f->vmemsz = t->vmemsz;
+    f->voff = t->voff;
+    f->entsz = entsz;
+    f->seed = seed;
+    f->nbucket = nbucket;
+    f->nentry = nslot;
+    f->sizearray = t->sizearray;
+    f->count = t->count;
+    memcpy((char*)f + f->pilot, pilot, sizeof(uint32_t) * nbucket);
+
+    sp = (char*)f + f->str;
+    for (i=0; i<n; i++) {
+        const struct ltable_key *key = &nodes[i]->key;
+        struct frozen_key *fk = fentry(f, pos[i]);
+        fk->type = key->type;
+        fk->len = key->len;
+        switch (key->type) {
+        case LTABLE_KEYSTR:
+            fk->v.off = sp - ((char*)f + f->str);
+            memcpy(sp, key->v.s, key->len);
+            sp += key->len + 1;
+            break;
+        case LTABLE_KEYINT:
+            fk->v.i = key->v.i; break;
+        case LTABLE_KEYNUM:
+            fk->v.f = key->v.f; break;
+        default:
+            fk->v.p = (uintptr_t)key->v.p; break;
+        }
+        memcpy((char*)fk + FROZEN_VALOFF, &nodes[i]->value, valmemsz(t));
+    }
+    for (i=0; i<(uint32_t)t->sizearray; i++)
+        memcpy((char*)f + f->array + valmemsz(t)*i, _garray(t, i), valmemsz(t));
+
+    free(nodes); free(hash); free(pos); free(pilot);
+
+    /* drop the mutable parts */
+    free(t->filter);
+    t->filter = NULL;
+    _freekeys(t);
+    _memfree(t->memflags, t->node, nodememsz(t) * sizenode(t));
+    _free_array(t);
+    pool_release(&t->pool);
+    pool_init(&t->pool);
+    _frozen_attach(t, f, true);
+    return 0;
+}
+
+/*
+** }=============================================================
+*/
+
 struct ltable*
 ltable_create(size_t vmemsz, unsigned int seed) {
     struct ltable* t = malloc(sizeof(struct ltable));
 
     t->vmemsz = vmemsz;
+    t->voff = _voff(vmemsz);
+    t->memflags = 0;
+    t->numanode = -1;
+    t->nodesz = _nodesz(t);
     t->array = NULL;
+    t->seg = NULL;
     t->node = NULL;
     t->lastfree = -1;
     t->sizearray = 0;
     t->lsizenode = 0;          /* log2 of size of `node' array */
     t->seed = seed == 0 ? LTABLE_SEED : seed;
+    t->count = 0;
+    t->bounded = false;
+    t->maxcount = 0;
+    t->maxbytes = 0;
+    t->evict = NULL;
+    t->evictud = NULL;
+    t->hand = 0;
+    t->frozen = NULL;
+    t->frozenowned = false;
+    t->filter = NULL;
+    t->fblocks = 0;
+    t->fbits = 0;
+    t->fk = 0;
+    t->fstale = 0;
+    t->fstats = false;
+    t->fqueries = t->frejects = t->ffalse = 0;
+    t->journal = NULL;
+    t->journalud = NULL;
+    memset(&t->jpending, 0, sizeof(t->jpending));
+    memset(&t->jout, 0, sizeof(t->jout));
     pool_init(&t->pool);
+    vpool_init(&t->vpool);
 
     _resize(t, 0, 1);
     return t;
@@ -575,58 +1768,369 @@ ltable_create(size_t vmemsz, unsigned int seed) {
 
 void
 ltable_release(struct ltable *t) {
-    free(t->node);
-    free(t->array);
+    int i;
+    if (t->frozen) {
+        if (t->frozenowned)
+            free((void*)t->frozen);
+        pool_release(&t->pool);
+        vpool_release(&t->vpool);
+        free(t->jpending.p);
+        free(t->jout.p);
+        free(t);
+        return;
+    }
+    for (i=0; i<t->sizearray; i++)
+        _freeval(t, _garray(t, i));
+    for (i=0; i<sizenode(t); i++)
+        _freeval(t, &_gnode(t, i)->value);
+    _freekeys(t);
+    _memfree(t->memflags, t->node, nodememsz(t) * sizenode(t));
+    _free_array(t);
+    free(t->filter);
+    free(t->jpending.p);
+    free(t->jout.p);
     pool_release(&t->pool);
+    vpool_release(&t->vpool);
+    free(t);
 }
 
 void
 ltable_resize(struct ltable *t, int nasize, int nhsize) {
+    if (t->frozen || nasize < 0 || nhsize < 0 ||
+        nasize > MAXASIZE || nhsize > MAXASIZE)
+        return;
+    if (t->journal) {
+        uint8_t op = LTABLE_JRESIZE;
+        int32_t size[2] = {nasize, nhsize};
+        _jput(&t->jpending, &op, 1);
+        _jput(&t->jpending, size, sizeof(size));
+    }
     _resize(t, nasize, nhsize);
 }
 
+int
+ltable_freeze(struct ltable *t) {
+    if (t->frozen) return 0;
+    if (t->journal)
+        _jflush(t);
+    if (_freeze(t))
+        return -1;
+    t->journal = NULL;          /* nothing changes any more */
+    return 0;
+}
+
+const void*
+ltable_image(struct ltable *t, size_t *sz) {
+    if (!t->frozen) return NULL;
+    if (sz) *sz = t->frozen->size;
+    return t->frozen;
+}
+
+/* `n' elements of `esz' bytes at `off' lie in the image */
+static bool
+_inimage(const struct frozen_header *f, uint64_t off, uint64_t n, uint64_t esz) {
+    if ((off & 7) || off < sizeof(*f) || off > f->size)
+        return false;
+    return esz == 0 || n <= (f->size - off) / esz;
+}
+
+/* header and regions only, O(1) so a mapped image isn't faulted in */
+static bool
+_frozen_check(const struct frozen_header *f, size_t sz) {
+    uint64_t valsz;
+    if (sz < sizeof(*f) || ((uintptr_t)f & 7) ||
+        f->magic != FROZEN_MAGIC || f->version != FROZEN_VERSION ||
+        f->size > sz || f->size < sizeof(*f) ||
+        f->vmemsz > f->size || f->voff != _voff(f->vmemsz))
+        return false;
+    valsz = f->vmemsz + f->voff;
+    if (f->nbucket < 1 || (f->entsz & 7) || f->entsz < FROZEN_VALOFF + valsz ||
+        f->sizearray > MAXASIZE || f->count > (uint64_t)f->nentry + f->sizearray)
+        return false;
+    if (!_inimage(f, f->pilot, f->nbucket, sizeof(uint32_t)) ||
+        !_inimage(f, f->entry, f->nentry, f->entsz) ||
+        !_inimage(f, f->array, f->sizearray, valsz) ||
+        !_inimage(f, f->str, 0, 0))
+        return false;
+    return true;
+}
+
+/* every key and value header, one pass over the image */
+static bool
+_frozen_verify(const struct frozen_header *f) {
+    uint64_t valsz = f->vmemsz + f->voff, strsz = f->size - f->str, i;
+    for (i=0; i<f->nentry; i++) {
+        const struct frozen_key *fk = fentry(f, i);
+        const struct ltable_value *v = (const struct ltable_value*)((char*)fk + FROZEN_VALOFF);
+        if (fk->type == 0 && !v->setted)
+            continue;           /* empty slot */
+        if (fk->type < LTABLE_KEYNUM || fk->type > LTABLE_KEYOBJ || !v->setted || v->outline)
+            return false;
+        if (fk->type == LTABLE_KEYSTR &&
+            (fk->v.off >= strsz || fk->len >= strsz - fk->v.off ||
+             fstr(f, fk)[fk->len] != '\0'))
+            return false;
+    }
+    for (i=0; i<f->sizearray; i++)
+        if (((const struct ltable_value*)((char*)f + f->array + valsz*i))->outline)
+            return false;
+    return true;
+}
+
+int
+ltable_verify(const void *image, size_t sz) {
+    const struct frozen_header *f = image;
+    return _frozen_check(f, sz) && _frozen_verify(f) ? 0 : -1;
+}
+
+struct ltable*
+ltable_load(const void *image, size_t sz) {
+    const struct frozen_header *f = image;
+    struct ltable *t;
+    if (!_frozen_check(f, sz))
+        return NULL;
+    t = ltable_create(f->vmemsz, 0);
+    _memfree(t->memflags, t->node, nodememsz(t) * sizenode(t));
+    _free_array(t);
+    _frozen_attach(t, f, false);
+    return t;
+}
+
+void
+ltable_setmem(struct ltable *t, int flags, int numanode) {
+    struct ltable old = *t;    /* old layout of the array part */
+    int oflags = t->memflags;
+    size_t onodesz = nodememsz(t);
+    int nsize = sizenode(t);
+    struct ltable_node *nold = t->node;
+    int i;
+
+    if (t->frozen) return;
+    t->memflags = flags;
+    t->numanode = numanode;
+
+    /* move array part */
+    if (!((oflags ^ flags) & LTABLE_MEMSEGMENT) && !(flags & LTABLE_MEMSEGMENT)) {
+        t->array = _memrealloc(t, oflags, t->array,
+                               valmemsz(t) * t->sizearray, valmemsz(t) * t->sizearray);
+    } else {
+        t->array = NULL;
+        t->seg = NULL;
+        t->sizearray = 0;
+        _resize_array(t, old.sizearray);
+        for (i=0; i<t->sizearray; i++)
+            _cpyval(t, _garray(t, i), _garray(&old, i));
+        _free_array(&old);
+    }
+
+    /* rebuild hash part with the new layout, same size */
+    t->nodesz = _nodesz(t);
+    _resize_node(t, nsize);
+    _reinsert(t, nold, nsize, onodesz);
+    _memfree(oflags, nold, onodesz * nsize);
+}
+
+void
+ltable_setlimit(struct ltable *t, size_t maxcount, size_t maxbytes,
+                ltable_evict_fn evict, void *ud) {
+    if (t->frozen) return;
+    t->maxcount = maxcount;
+    t->maxbytes = maxbytes;
+    t->evict = evict;
+    t->evictud = ud;
+    t->bounded = maxcount || maxbytes;
+    if (t->bounded)
+        _evict(t, 0, 0, NULL);
+}
+
+void
+ltable_setfilter(struct ltable *t, int bitsperkey, bool stats) {
+    free(t->filter);
+    t->filter = NULL;
+    t->fblocks = 0;
+    t->fstats = false;
+    t->fqueries = t->frejects = t->ffalse = 0;
+    if (t->frozen || bitsperkey <= 0)
+        return;
+    t->fstats = stats;
+    t->fbits = bitsperkey < 64 ? bitsperkey : 64;  /* keeps fblocks in 32 bits */
+    t->fk = (t->fbits * 69 + 50) / 100;     /* ln2 * bits per key */
+    if (t->fk < 1) t->fk = 1;
+    if (t->fk > 16) t->fk = 16;
+    _frebuild(t);
+}
+
+void
+ltable_filterstat(struct ltable *t, struct ltable_filterstat *st) {
+    size_t negatives = t->frejects + t->ffalse;
+    st->queries = t->fqueries;
+    st->rejects = t->frejects;
+    st->falsepos = t->ffalse;
+    st->bytes = t->filter ? (size_t)t->fblocks * FBLOCK_BITS / 8 : 0;
+    st->fpr = negatives ? (double)t->ffalse / negatives : 0;
+}
+
+void
+ltable_journal(struct ltable *t, ltable_journal_fn fn, void *ud) {
+    if (t->frozen) return;
+    _jreset(t);
+    t->journal = fn;
+    t->journalud = ud;
+}
+
+void
+ltable_journal_flush(struct ltable *t) {
+    if (t->journal) _jflush(t);
+}
+
+void
+ltable_journal_snapshot(struct ltable *t) {
+    struct ltable_key key;
+    int i;
+    if (!t->journal) return;
+    for (i=0; i<t->sizearray; i++) {
+        struct ltable_value *val = _garray(t, i);
+        if (!isnil(val)) _jset(t, ltable_intkey(&key, i), val);
+    }
+    for (i=0; i<sizenode(t); i++) {
+        struct ltable_node *node = _gnode(t, i);
+        if (!isnilnode(node)) _jset(t, &node->key, &node->value);
+    }
+}
+
+int
+ltable_apply(struct ltable *t, const void *buf, size_t sz) {
+    const char *p = buf, *end = p + sz;
+    int n = 0;
+    if (t->frozen) return -1;
+    while (p < end) {
+        struct ltable_key key;
+        uint8_t op = *p++;
+        if (op == LTABLE_JRESIZE) {
+            int32_t size[2];
+            if ((size_t)(end - p) < sizeof(size))
+                return -1;
+            memcpy(size, p, sizeof(size));
+            p += sizeof(size);
+            if (size[0] < 0 || size[1] < 0 || size[0] > MAXASIZE || size[1] > MAXASIZE)
+                return -1;
+            ltable_resize(t, size[0], size[1]);
+        } else if (op == LTABLE_JDEL) {
+            if (!(p = _jgetkey(p, end, &key)))
+                return -1;
+            ltable_del(t, &key);
+        } else if (op == LTABLE_JSET) {
+            uint32_t vlen;
+            void *v;
+            if (!(p = _jgetkey(p, end, &key)) || end - p < 4)
+                return -1;
+            memcpy(&vlen, p, 4);
+            p += 4;
+            if ((size_t)(end - p) < vlen)
+                return -1;
+            if (!(v = ltable_set_sized(t, &key, vlen)))
+                return -1;
+            memcpy(v, p, vlen);
+            p += vlen;
+        } else {
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+size_t
+ltable_count(struct ltable *t) {
+    return t->count;
+}
+
+size_t
+ltable_bytes(struct ltable *t) {
+    return _charge(t);
+}
+
 void*
 ltable_get(struct ltable *t, const struct ltable_key* key) {
     struct ltable_value *val = _get(t, key);
-    return _gud(val);
+    if (val && t->bounded) val->ref = true;
+    return _gud(t, val);
 }
 
 void*
 ltable_set(struct ltable* t, const struct ltable_key* key) {
     struct ltable_value *val = _get(t, key);
-    if (!val) val = _set(t, key);
-    return _gud(val);
+    if (!val && t->frozen)
+        return NULL;            /* no new keys in a frozen table */
+    if (!val)
+        val = _insert(t, key, 0);
+    else if (t->bounded)
+        val->ref = true;
+    if (t->journal)
+        _jset(t, key, val);
+    return _gud(t, val);
+}
+
+void*
+ltable_set_sized(struct ltable* t, const struct ltable_key* key, size_t sz) {
+    struct ltable_value *val;
+    if (sz > t->vmemsz && t->vmemsz < sizeof(void*))
+        return NULL;            /* no room in slot for the vblock addr */
+    if (t->frozen)
+        return sz <= t->vmemsz ? _gud(t, _get(t, key)) : NULL;
+    val = _get(t, key);
+    if (!val) {
+        val = _insert(t, key, sz);
+    } else if (t->bounded) {
+        val->ref = true;
+        if (sz > t->vmemsz)
+            _evict(t, 0, ((size_t)1 << vpool_class(sz)) + sizeof(struct vblock), val);
+    }
+    if (t->journal)
+        _jset(t, key, val);
+    return _sizeval(t, val, sz);
+}
+
+size_t
+ltable_valsize(struct ltable* t, const struct ltable_key* key) {
+    struct ltable_value *val = _get(t, key);
+    return val ? _valsize(t, val) : 0;
 }
 
 void*
 ltable_getn(struct ltable* t, int i) {
+    struct ltable_value *val = NULL;
     if (inarray(t, i)) {
-        struct ltable_value *val = _garray(t, i);
-        return _gud(val);
-    } 
-
-    struct ltable_key k;
-    ltable_intkey(&k, i);
-    struct ltable_node *node = _hashget(t, &k);
-    if (node)
-        return _gud(&node->value);
-    return NULL;
+        val = _garray(t, i);
+    } else {
+        struct ltable_key k;
+        ltable_intkey(&k, i);
+        if (t->frozen) {
+            val = _frozenget(t, &k);
+        } else {
+            struct ltable_node *node = _hashget(t, &k);
+            if (node) val = &node->value;
+        }
+    }
+    if (val && t->bounded && !isnil(val)) val->ref = true;
+    return _gud(t, val);
 }
 
 void
 ltable_del(struct ltable* t, const struct ltable_key* key) {
-    if (key->type == LTABLE_KEYSTR) {
-        struct ltable_node *node = _hashget(t, key);
-        if (node) {
-            node->value.setted = false;
-            /* free string key */
-            pool_free(&t->pool, (struct pool_node*)node->key.v.s);
-            node->key.v.s = NULL;
-        }
+    int idx = arrayindex(key);
+    if (t->frozen) return;
+    if (inarray(t, idx)) {
+        struct ltable_value *val = _garray(t, idx);
+        if (isnil(val)) return;
+        _delarray(t, val);
     } else {
-        struct ltable_value *val = _get(t, key);
-        if (val) val->setted = false;
+        struct ltable_node *node = _hashget(t, key);
+        if (!node) return;
+        _delnode(t, node);
     }
+    if (t->journal)
+        _jputkey(&t->jpending, LTABLE_JDEL, key);
 }
 
 void *
@@ -646,7 +2150,17 @@ ltable_next(struct ltable *t, unsigned int *ip, struct ltable_key *key) {
             break;
         }
     }
-    if (i >= t->sizearray)
+    if (i >= t->sizearray && t->frozen) {
+        const struct frozen_header *f = t->frozen;
+        for (; i < (int)f->nentry + t->sizearray; i++) {
+            struct frozen_key *fk = fentry(f, i - t->sizearray);
+            if (fk->type == 0)
+                continue;       /* empty slot */
+            if (key) _frozenkey(f, fk, key);
+            val = (struct ltable_value*)((char*)fk + FROZEN_VALOFF);
+            break;
+        }
+    } else if (i >= t->sizearray)
         for (;i < nsz + t->sizearray; i++) { /* search hash part */
             struct ltable_node * node = _gnode(t, i - t->sizearray);
             if (!isnilnode(node)) {
@@ -657,7 +2171,7 @@ ltable_next(struct ltable *t, unsigned int *ip, struct ltable_key *key) {
         }
 
     *ip = i+1;
-    return _gud(val);
+    return _gud(t, val);
 }
 
 inline struct ltable_key*
@@ -670,12 +2184,25 @@ ltable_numkey(struct ltable_key *key, double k) {
 
 inline struct ltable_key*
 ltable_strkey(struct ltable_key *key, const char* k) {
+    size_t len = strlen(k);
+    assert(len <= UINT_MAX);    /* longer strings don't fit `len' */
     key->type = LTABLE_KEYSTR;
+    key->len  = len;
     key->v.s  = k;
 
     return key;
 }
 
+inline struct ltable_key*
+ltable_lstrkey(struct ltable_key *key, const char* k, size_t len) {
+    assert(len <= UINT_MAX);
+    key->type = LTABLE_KEYSTR;
+    key->len  = len;
+    key->v.s  = k ? k : "";     /* e.g. an empty std::string_view */
+
+    return key;
+}
+
 inline struct ltable_key*
 ltable_intkey(struct ltable_key *key, long int k) {
     key->type = LTABLE_KEYINT;
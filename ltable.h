@@ -2,6 +2,11 @@
 #define LTABLE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define LTABLE_SEED
 
@@ -10,11 +15,20 @@
 #define LTABLE_KEYSTR      3
 #define LTABLE_KEYOBJ      4
 
+/* flags for ltable_setmem */
+#define LTABLE_MEMHUGE        1   /* mmap big parts, advise transparent huge pages */
+#define LTABLE_MEMHUGETLB     2   /* explicit hugetlb pages, LTABLE_MEMHUGE if none */
+#define LTABLE_MEMBIND        4   /* bind big parts to one NUMA node */
+#define LTABLE_MEMINTERLEAVE  8   /* interleave big parts across allowed NUMA nodes */
+#define LTABLE_MEMALIGN      16   /* no node straddles a cache line */
+#define LTABLE_MEMSEGMENT    32   /* array part in fixed segments, grows without copying */
+
 #define ltable_keytype(key) ((key)->type)
 #define ltable_keyval(key)    ((key)->v)
 
 struct ltable_key {
     int type;
+    unsigned int len;           /* string length, LTABLE_KEYSTR only */
     union {
         double f;
         long int i;
@@ -26,19 +40,62 @@ struct ltable_key {
 
 struct ltable;
 
+/* see ltable_filterstat */
+struct ltable_filterstat {
+    size_t queries;             /* hash part lookups through the filter */
+    size_t rejects;             /* misses answered by the filter alone */
+    size_t falsepos;            /* misses the filter let through */
+    size_t bytes;
+    double fpr;                 /* falsepos / all misses */
+};
+
+/* change journal record ops, see ltable_journal */
+#define LTABLE_JSET     1
+#define LTABLE_JDEL     2
+#define LTABLE_JRESIZE  3
+
+/* receives whole journal records */
+typedef void (*ltable_journal_fn)(void *ud, const void *buf, size_t sz);
+
+/* called with the entry about to be evicted from a bounded table */
+typedef void (*ltable_evict_fn)(void *ud, const struct ltable_key *key, void *value);
+
 struct ltable*  ltable_create(size_t vmemsz, unsigned int seed);
 void  ltable_release(struct ltable *);
 void  ltable_resize(struct ltable *t, int nasize, int nhsize);
+void  ltable_setmem(struct ltable *t, int flags, int numanode);
+void  ltable_setlimit(struct ltable *t, size_t maxcount, size_t maxbytes,
+                      ltable_evict_fn evict, void *ud);
+void  ltable_setfilter(struct ltable *t, int bitsperkey, bool stats);
+void  ltable_filterstat(struct ltable *t, struct ltable_filterstat *st);
+void  ltable_journal(struct ltable *t, ltable_journal_fn fn, void *ud);
+void  ltable_journal_flush(struct ltable *t);
+void  ltable_journal_snapshot(struct ltable *t);
+int   ltable_apply(struct ltable *t, const void *buf, size_t sz);
+size_t ltable_count(struct ltable *t);
+size_t ltable_bytes(struct ltable *t);
 void* ltable_next(struct ltable *t, unsigned int *ip, struct ltable_key *key);
 
+int   ltable_freeze(struct ltable *t);
+const void* ltable_image(struct ltable *t, size_t *sz);
+struct ltable* ltable_load(const void *image, size_t sz);
+int   ltable_verify(const void *image, size_t sz);
+
 void* ltable_get(struct ltable* t, const struct ltable_key* key);
 void* ltable_set(struct ltable* t, const struct ltable_key* key);
+void* ltable_set_sized(struct ltable* t, const struct ltable_key* key, size_t sz);
+size_t ltable_valsize(struct ltable* t, const struct ltable_key* key);
 void* ltable_getn(struct ltable* t, int i);
 void  ltable_del(struct ltable* t, const struct ltable_key* key);
 
 struct ltable_key* ltable_numkey(struct ltable_key *key, double k);
 struct ltable_key* ltable_strkey(struct ltable_key *key, const char* k);
+struct ltable_key* ltable_lstrkey(struct ltable_key *key, const char* k, size_t len);
 struct ltable_key* ltable_intkey(struct ltable_key *key, long int k);
 struct ltable_key* ltable_objkey(struct ltable_key *key, const void *p);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
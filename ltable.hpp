@@ -0,0 +1,206 @@
+#ifndef LTABLE_HPP
+#define LTABLE_HPP
+
+/*
+** C++17 wrapper, header only.
+**
+**   lt::ltable<std::string> t;
+**   t["foo"] = "bar";
+**   if (auto *v = t.find(std::string_view(buf, len))) ...
+**   for (auto [k, v] : t) ...
+*/
+
+#include <climits>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "ltable.h"
+
+namespace lt {
+
+template <class K>
+struct ltable_key
+make_key(const K &k) {
+    struct ltable_key key;
+    if constexpr (std::is_integral_v<K>) {
+        ltable_intkey(&key, static_cast<long int>(k));
+    } else if constexpr (std::is_floating_point_v<K>) {
+        ltable_numkey(&key, static_cast<double>(k));
+    } else if constexpr (std::is_convertible_v<const K&, std::string_view>) {
+        std::string_view s(k);
+        if (s.size() > UINT_MAX)
+            throw std::length_error("lt::make_key: string key longer than UINT_MAX");
+        ltable_lstrkey(&key, s.data(), s.size());
+    } else {
+        static_assert(std::is_pointer_v<K>, "key must be integral, floating, string or pointer");
+        ltable_objkey(&key, static_cast<const void*>(k));
+    }
+    return key;
+}
+
+/* string of a LTABLE_KEYSTR key, as returned by iteration */
+inline std::string_view
+key_string(const struct ltable_key &key) {
+    return std::string_view(key.v.s, key.len);
+}
+
+template <class V>
+class ltable {
+    /*
+    ** the table moves values around with memcpy on rehash, so only
+    ** trivially copyable values are kept in their slot, others are boxed.
+    */
+    static constexpr bool inslot = std::is_trivially_copyable_v<V> && alignof(V) <= 8;
+    using slot_type = std::conditional_t<inslot, V, V*>;
+
+    struct ::ltable *t_;         /* null once moved from, until the next insert */
+
+    static V&
+    value(void *p) {
+        if constexpr (inslot)
+            return *std::launder(static_cast<V*>(p));
+        else
+            return **static_cast<V**>(p);
+    }
+
+    static void
+    destroy(void *p) {
+        if constexpr (inslot)
+            static_cast<V*>(p)->~V();
+        else
+            delete *static_cast<V**>(p);
+    }
+
+    static struct ::ltable*
+    create(unsigned int seed) {
+        struct ::ltable *t = ltable_create(sizeof(slot_type), seed);
+        if (!t) throw std::bad_alloc();
+        return t;
+    }
+
+    void
+    reset() {
+        unsigned int i = 0;
+        void *p;
+        if (!t_)
+            return;
+        while ((p = ltable_next(t_, &i, nullptr)))
+            destroy(p);
+        ltable_release(t_);
+        t_ = nullptr;
+    }
+
+public:
+    class iterator {
+        struct ::ltable *t_ = nullptr;
+        unsigned int i_ = 0;
+        struct ltable_key key_{};
+        void *p_ = nullptr;
+
+        void
+        advance() {
+            p_ = ltable_next(t_, &i_, &key_);
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const struct ltable_key&, V&>;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        using pointer = void;
+
+        iterator() = default;
+        explicit iterator(struct ::ltable *t) : t_(t) { advance(); }
+
+        reference operator*() const { return reference(key_, value(p_)); }
+        iterator& operator++() { advance(); return *this; }
+        iterator operator++(int) { iterator it = *this; advance(); return it; }
+        bool operator==(const iterator &o) const { return p_ == o.p_; }
+        bool operator!=(const iterator &o) const { return p_ != o.p_; }
+    };
+
+    explicit ltable(unsigned int seed = 0) : t_(create(seed)) {}
+
+    ~ltable() { reset(); }
+
+    ltable(ltable &&o) noexcept : t_(std::exchange(o.t_, nullptr)) {}
+
+    ltable&
+    operator=(ltable &&o) noexcept {
+        if (this != &o) {
+            reset();
+            t_ = std::exchange(o.t_, nullptr);
+        }
+        return *this;
+    }
+
+    ltable(const ltable&) = delete;
+    ltable& operator=(const ltable&) = delete;
+
+    /* the C table, e.g. for ltable_setmem. don't delete or evict through it */
+    struct ::ltable* get() const { return t_; }
+
+    std::size_t size() const { return t_ ? ltable_count(t_) : 0; }
+    bool empty() const { return size() == 0; }
+
+    template <class K>
+    V*
+    find(const K &k) const {
+        struct ltable_key key = make_key(k);
+        void *p = t_ ? ltable_get(t_, &key) : nullptr;
+        return p ? &value(p) : nullptr;
+    }
+
+    template <class K>
+    bool contains(const K &k) const { return find(k) != nullptr; }
+
+    /* construct V from `args' if `k' is missing, the bool tells if it was */
+    template <class K, class... Args>
+    std::pair<V*, bool>
+    try_emplace(const K &k, Args&&... args) {
+        struct ltable_key key = make_key(k);
+        if (!t_)
+            t_ = create(0);
+        std::size_t n = ltable_count(t_);
+        void *p = ltable_set(t_, &key);     /* one lookup, inserts if missing */
+        if (ltable_count(t_) == n)
+            return {&value(p), false};
+        try {
+            if constexpr (inslot)
+                ::new (p) V(std::forward<Args>(args)...);
+            else
+                *static_cast<V**>(p) = new V(std::forward<Args>(args)...);
+        } catch (...) {
+            ltable_del(t_, &key);
+            throw;
+        }
+        return {&value(p), true};
+    }
+
+    template <class K>
+    V& operator[](const K &k) { return *try_emplace(k).first; }
+
+    template <class K>
+    bool
+    erase(const K &k) {
+        struct ltable_key key = make_key(k);
+        void *p = t_ ? ltable_get(t_, &key) : nullptr;
+        if (!p)
+            return false;
+        destroy(p);
+        ltable_del(t_, &key);
+        return true;
+    }
+
+    iterator begin() const { return t_ ? iterator(t_) : iterator(); }
+    iterator end() const { return iterator(); }
+};
+
+} /* namespace lt */
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "ltable.h"
 
 static void
@@ -40,6 +41,24 @@ _dump(struct ltable *t) {
     }
 }
 
+static void
+_evicted(void *ud, const struct ltable_key *key, void *value) {
+    printf("\tevict ['%s'], val=%d\n", key->v.s, *(int*)value);
+}
+
+static void
+_filterstat(struct ltable *t, const char *what) {
+    struct ltable_filterstat st;
+    ltable_filterstat(t, &st);
+    printf("\t%-8s queries=%zu rejects=%zu falsepos=%zu bytes=%zu\n",
+           what, st.queries, st.rejects, st.falsepos, st.bytes);
+}
+
+static void
+_replicate(void *ud, const void *buf, size_t sz) {
+    printf("\tapply %zu bytes, %d records\n", sz, ltable_apply(ud, buf, sz));
+}
+
 int
 main() {
     struct ltable_key key;
@@ -86,4 +105,179 @@ main() {
     _dump(t);
 
     ltable_release(t);
+
+    /*****************************/
+    /* variable-size values */
+    /*****************************/
+
+    t = ltable_create(sizeof(void*), 0);
+    char *s = ltable_set_sized(t, ltable_strkey(&key, "small"), 4);
+    strcpy(s, "abc");
+    s = ltable_set_sized(t, ltable_strkey(&key, "large"), 1024);
+    memset(s, 'x', 1023);
+    s[1023] = 0;
+    s = ltable_set_sized(t, ltable_strkey(&key, "small"), 64); /* grow, keep content */
+    printf("sized values:\n\tsmall='%s', large has %zu bytes\n",
+           s, strlen(ltable_get(t, ltable_strkey(&key, "large"))));
+    printf("\tsize of small=%zu large=%zu\n", ltable_valsize(t, ltable_strkey(&key, "small")),
+           ltable_valsize(t, ltable_strkey(&key, "large")));
+    ltable_del(t, ltable_strkey(&key, "large"));
+
+    ltable_release(t);
+
+    /*****************************/
+    /* memory layout */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    for(i=0;i<100000;i++) {     /* a hash part of some MB */
+        p = ltable_set(t, ltable_numkey(&key, i+0.5));
+        *p = i;
+    }
+    p = ltable_set(t, ltable_strkey(&key, "mem"));
+    *p = 42;
+    ltable_setmem(t, LTABLE_MEMALIGN, -1);     /* pad nodes, re-insert them */
+    ltable_setmem(t, LTABLE_MEMHUGE|LTABLE_MEMALIGN, -1);  /* mmap the hash part */
+    for(i=0;i<100000;i++) {
+        p = ltable_get(t, ltable_numkey(&key, i+0.5));
+        if (!p || *p != i)
+            break;
+    }
+    printf("setmem:\n\t%d of 100000 kept, mem=%d, count=%zu\n", i,
+           *(int*)ltable_get(t, ltable_strkey(&key, "mem")), ltable_count(t));
+    ltable_setmem(t, 0, -1);
+    ltable_del(t, ltable_strkey(&key, "mem"));
+    printf("\tback to malloc, count=%zu\n", ltable_count(t));
+
+    ltable_release(t);
+
+    /*****************************/
+    /* bounded cache */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    ltable_setlimit(t, 4, 0, _evicted, NULL);
+    for(i=0;i<6;i++) {
+        char name[16];
+        sprintf(name, "item%d", i);
+        p = ltable_set(t, ltable_strkey(&key, name));
+        *p = i;
+        ltable_get(t, ltable_strkey(&key, "item0")); /* keep item0 hot */
+    }
+    printf("cache holds %zu items\n", ltable_count(t));
+    _dump(t);
+
+    ltable_release(t);
+
+    /*****************************/
+    /* segmented array part */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    ltable_setmem(t, LTABLE_MEMSEGMENT, -1);
+    for(i=0;i<200000;i++) {     /* several segments of 65536 */
+        p = ltable_set(t, ltable_intkey(&key, i));
+        *p = i*2;
+    }
+    printf("segmented:\n\t[0]=%d [65536]=%d [199999]=%d\n", *(int*)ltable_getn(t, 0),
+           *(int*)ltable_getn(t, 65536), *(int*)ltable_getn(t, 199999));
+    ltable_resize(t, 70000, 0); /* drop segments, the rest moves to the hash part */
+    ltable_setmem(t, 0, -1);    /* back to one contiguous array */
+    for(i=0;i<200000;i++) {
+        p = ltable_getn(t, i);
+        if (!p || *p != i*2)
+            break;
+    }
+    printf("\t%d of 200000 kept, count=%zu\n", i, ltable_count(t));
+
+    ltable_release(t);
+
+    /*****************************/
+    /* frozen table */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    for(i=0;i<4;i++) {
+        p = ltable_set(t, ltable_intkey(&key, i));
+        *p = i*i;
+    }
+    p = ltable_set(t, ltable_strkey(&key, "route:/index"));
+    *p = 200;
+    p = ltable_set(t, ltable_strkey(&key, "route:/admin"));
+    *p = 403;
+    ltable_freeze(t);
+
+    /* the image could be written to a file and mmapped back */
+    size_t sz;
+    const void *image = ltable_image(t, &sz);
+    struct ltable *loaded = ltable_verify(image, sz) ? NULL : ltable_load(image, sz);
+    p = ltable_get(loaded, ltable_strkey(&key, "route:/admin"));
+    printf("frozen image of %zu bytes, route:/admin=%d\n", sz, *p);
+    _dump(loaded);
+
+    ltable_release(loaded);
+    ltable_release(t);
+
+    /*****************************/
+    /* negative lookup filter */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    ltable_setfilter(t, 10, true);
+    char name[16];
+    for(i=0;i<100;i++) {
+        sprintf(name, "user%d", i);
+        p = ltable_set(t, ltable_strkey(&key, name));
+        *p = i;
+    }
+    printf("filter:\n");
+    _filterstat(t, "insert");  /* each ltable_set looked the key up first */
+    for(i=0;i<100;i++) {
+        sprintf(name, "user%d", i);
+        ltable_get(t, ltable_strkey(&key, name));
+        sprintf(name, "guest%d", i);
+        ltable_get(t, ltable_strkey(&key, name));
+    }
+    _filterstat(t, "get");
+    for(i=0;i<50;i++) {
+        sprintf(name, "user%d", i);
+        ltable_del(t, ltable_strkey(&key, name));
+    }
+    for(i=0;i<50;i++) {         /* deleted keys are still in the filter */
+        sprintf(name, "user%d", i);
+        ltable_get(t, ltable_strkey(&key, name));
+    }
+    _filterstat(t, "deleted");
+    ltable_resize(t, 0, 64);    /* rebuilds the filter without them */
+    for(i=0;i<50;i++) {
+        sprintf(name, "user%d", i);
+        ltable_get(t, ltable_strkey(&key, name));
+    }
+    _filterstat(t, "resized");
+    p = ltable_get(t, ltable_strkey(&key, "user99"));
+    printf("\tuser99=%d, count=%zu\n", *p, ltable_count(t));
+
+    ltable_release(t);
+
+    /*****************************/
+    /* change journal */
+    /*****************************/
+
+    t = ltable_create(sizeof(int), 0);
+    struct ltable *replica = ltable_create(sizeof(int), 0);
+    ltable_journal(t, _replicate, replica);
+    for(i=0;i<3;i++) {
+        p = ltable_set(t, ltable_intkey(&key, i));
+        *p = i;
+    }
+    p = ltable_set(t, ltable_strkey(&key, "count"));
+    *p = 1;
+    *p = 2;                     /* only the value at flush is sent */
+    ltable_del(t, ltable_intkey(&key, 0));
+    printf("journal:\n");
+    ltable_journal_flush(t);
+    _dump(replica);
+
+    ltable_release(replica);
+    ltable_release(t);
 }
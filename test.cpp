@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include "ltable.hpp"
+
+int
+main() {
+    /* values are constructed and destroyed, keys need no copy */
+    lt::ltable<std::string> t;
+    t["foo"] = "bar";
+    t[3.5] = "three and a half";
+    t[7] = "seven";
+    t.try_emplace("hello,world", 3, '!');
+
+    const char buf[] = "foo-and-more";
+    std::string_view foo(buf, 3);   /* not NUL terminated */
+    if (std::string *v = t.find(foo))
+        printf("find foo: %s\n", v->c_str());
+
+    t.erase(7);
+    lt::ltable<std::string> moved = std::move(t);
+
+    printf("iter table, %zu items:\n", moved.size());
+    for (auto [k, v] : moved) {
+        if (k.type == LTABLE_KEYSTR)
+            printf("\tkey=['%s'], val=%s\n", std::string(lt::key_string(k)).c_str(), v.c_str());
+        else
+            printf("\tkey=%.3f, val=%s\n", k.v.f, v.c_str());
+    }
+
+    /* trivially copyable values stay in their slot */
+    lt::ltable<double> a;
+    for (int i=0; i<10; i++)
+        a[i] = i * 0.5;
+    printf("a[9] = %.1f\n", *a.find(9));
+    return 0;
+}